@@ -0,0 +1,115 @@
+#ifndef NEXA_NODE_CYCLE_CLOCK_H
+#define NEXA_NODE_CYCLE_CLOCK_H
+
+#include <stdint.h>
+
+/*
+ * High-resolution timestamps from the Cortex-M3 cycle counter.
+ *
+ * The DWT cycle counter (CYCCNT) is a free-running 32-bit counter that
+ * is incremented on every CPU clock cycle. Reading it is a single load,
+ * much cheaper than micros(), and gives sub-µs resolution (1/72 µs on
+ * the 72 MHz Spark Core).
+ *
+ * Timestamps wrap around every 2^32 ticks (~59.6 s at 72 MHz). Intervals
+ * computed with elapsed() are correct across a wraparound, as long as
+ * they are shorter than that.
+ *
+ * Converting ticks to µs would take a division by the clock frequency
+ * (a 64-bit one for to_us16()), on every captured pulse. Instead, the
+ * conversions multiply by a fixed-point reciprocal of the frequency,
+ * which begin() computes once; the results are exact, as if divided.
+ *
+ * Host builds (NEXA_NODE_HOST, see tools/host/spark_host.h) get a mock
+ * counter that is advanced manually (see advance()), so that capture and
+ * statistics code can be exercised on a host.
+ */
+namespace CycleClock {
+	typedef uint32_t ticks_t;
+
+	// Fixed-point reciprocals of ticks_per_us(), set by begin()
+	uint64_t us_recip = 0; // 2^64 / ticks_per_us()
+	uint64_t us16_recip = 0; // 2^68 / ticks_per_us()
+
+	/*
+	 * Return 2^(64 + shift) / d + 1 (rounded down), for d > 2^shift. Then
+	 * x * reciprocal(d, shift) / 2^64 == (x << shift) / d for all
+	 * 32-bit x (rounded down), since the rounding error is < 2^-32.
+	 */
+	inline uint64_t reciprocal(uint32_t d, unsigned shift)
+	{
+		uint64_t q = ~0ULL / d, r = ~0ULL % d; // of 2^64 - 1
+		return (q << shift) + ((r << shift) + (1U << shift) - 1) / d + 1;
+	}
+
+	// Return x * m / 2^64, rounded down, without 64-bit division.
+	inline uint32_t mul_hi(uint32_t x, uint64_t m)
+	{
+		uint64_t lo = (uint64_t) x * (uint32_t) m;
+		uint64_t hi = (uint64_t) x * (uint32_t) (m >> 32);
+		return (hi + (lo >> 32)) >> 32;
+	}
+
+#if defined(NEXA_NODE_HOST)
+	ticks_t mock_ticks = 0;
+
+	inline uint32_t ticks_per_us() { return 72; }
+	inline ticks_t now() { return mock_ticks; }
+
+	inline void begin()
+	{
+		us_recip = reciprocal(ticks_per_us(), 0);
+		us16_recip = reciprocal(ticks_per_us(), 4);
+	}
+
+	// Advance the mock counter by the given number of µs.
+	inline void advance(uint32_t usecs) { mock_ticks += usecs * ticks_per_us(); }
+#elif defined(SPARK) || defined(PLATFORM_ID)
+	namespace Reg {
+		volatile uint32_t & DEMCR = *(volatile uint32_t *) 0xE000EDFC;
+		volatile uint32_t & DWT_CTRL = *(volatile uint32_t *) 0xE0001000;
+		volatile uint32_t & DWT_CYCCNT = *(volatile uint32_t *) 0xE0001004;
+	}
+
+	// CPU clock frequency in MHz
+	inline uint32_t ticks_per_us() { return SystemCoreClock / 1000000; }
+
+	// Return the current timestamp.
+	inline ticks_t now() { return Reg::DWT_CYCCNT; }
+
+	/*
+	 * Start the cycle counter, and set up the µs conversions. Must be
+	 * called before converting ticks to µs. May be called more than
+	 * once.
+	 */
+	inline void begin()
+	{
+		Reg::DEMCR |= 1UL << 24; // TRCENA: enable DWT
+		Reg::DWT_CTRL |= 1; // CYCCNTENA: enable cycle counter
+		us_recip = reciprocal(ticks_per_us(), 0);
+		us16_recip = reciprocal(ticks_per_us(), 4);
+	}
+#else
+#error "No cycle counter: build for the Spark Core, or define NEXA_NODE_HOST"
+#endif
+
+	// Return the number of ticks from timestamp "from" until "to".
+	inline ticks_t elapsed(ticks_t from, ticks_t to) { return to - from; }
+
+	// Convert the given number of µs into ticks.
+	inline ticks_t from_us(uint32_t usecs) { return usecs * ticks_per_us(); }
+
+	// Convert the given number of ticks into (whole) µs.
+	inline uint32_t to_us(ticks_t ticks) { return mul_hi(ticks, us_recip); }
+
+	/*
+	 * Convert the given number of ticks into 1/16 µs units. All
+	 * intervals up to the wraparound period convert without overflow.
+	 */
+	inline uint32_t to_us16(ticks_t ticks)
+	{
+		return mul_hi(ticks, us16_recip);
+	}
+}
+
+#endif
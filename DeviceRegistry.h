@@ -0,0 +1,205 @@
+#ifndef NEXA_NODE_DEVICE_REGISTRY_H
+#define NEXA_NODE_DEVICE_REGISTRY_H
+
+#include "Macros.h"
+#include "NexaCommand.h"
+
+/*
+ * Registry of known 32-bit Nexa device ids, and their paired channels.
+ *
+ * Channels are learned from commands that are received from (or sent
+ * to) each device id, and can also be set explicitly with pair(). The
+ * paired channel set of a device is stored as a 16-bit mask, with bit N
+ * set iff channel N is paired. Once a device has been paired explicitly,
+ * its mask is only changed by pair(); learned channels are ignored, since
+ * commands seen on the air do not prove that no other channel is paired.
+ *
+ * The last known state (on/off) of each paired channel is kept in a
+ * second mask, with bit N set iff channel N is on. Group commands switch
+ * all paired channels of a device.
+ *
+ * Only NEXA_32BIT devices have channels; other commands are ignored.
+ */
+class DeviceRegistry {
+public: // types & constants
+	static const size_t max_devices = 16;
+
+	struct Device {
+		unsigned long id; // 24-bit device id
+		uint16_t channels; // bit N set iff channel N is paired
+		uint16_t states; // bit N set iff channel N is on
+		bool configured; // channels were set by pair()
+	};
+
+public: // initializers
+	DeviceRegistry() : num_devices(0) { }
+
+public: // commands
+	/*
+	 * Record the channel of the given command as paired with its
+	 * device id, and the state of the command as the channel's state.
+	 * Group commands carry no channel; they set the state of all
+	 * paired channels.
+	 *
+	 * Return false if the registry is full.
+	 */
+	bool learn(const NexaCommand & cmd);
+
+	/*
+	 * Set the paired channels of the given device id to exactly the
+	 * given mask. A zero mask forgets the device.
+	 *
+	 * Return false if the registry is full.
+	 */
+	bool pair(unsigned long device_id, uint16_t channels);
+
+	/*
+	 * Set the paired channels and their states of the given device id,
+	 * and whether they were set by pair(), e.g. as saved before a reboot.
+	 *
+	 * Return false if the registry is full.
+	 */
+	bool restore(unsigned long device_id, uint16_t channels,
+		     uint16_t states, bool configured);
+
+public: // queries
+	// Return the paired channel mask of the given device id.
+	uint16_t channels(unsigned long device_id) const;
+
+	/*
+	 * Return the paired channel mask of the given device id, if it was
+	 * set by pair(), otherwise 0.
+	 */
+	uint16_t configured(unsigned long device_id) const;
+
+	// Return the mask of paired channels that are on.
+	uint16_t states(unsigned long device_id) const;
+
+	// Return the number of devices, and the i-th device
+	size_t size() const { return num_devices; }
+	const Device & operator[](size_t i) const { return devices[i]; }
+
+	void print(Print & out) const;
+
+private: // helpers
+	int index_of(unsigned long device_id) const;
+
+	/*
+	 * Set the paired channels of the given device id, adding it if
+	 * needed. Return its index, or -1 if the registry is full.
+	 */
+	int set_channels(unsigned long device_id, uint16_t channels);
+
+private: // representation
+	Device devices[max_devices];
+	size_t num_devices;
+};
+
+bool DeviceRegistry::learn(const NexaCommand & cmd)
+{
+	if (cmd.version != NexaCommand::NEXA_32BIT)
+		return true;
+
+	unsigned long id = cmd.device_id();
+	int i = index_of(id);
+	if (cmd.group) {
+		if (i != -1)
+			devices[i].states = cmd.state ? devices[i].channels : 0;
+		return true;
+	}
+	uint16_t bit = 1 << cmd.channel;
+	if (i == -1) {
+		i = set_channels(id, bit);
+		if (i == -1)
+			return false;
+	}
+	else if (!devices[i].configured)
+		devices[i].channels |= bit;
+	if (cmd.state)
+		devices[i].states |= bit & devices[i].channels;
+	else
+		devices[i].states &= ~bit;
+	return true;
+}
+
+bool DeviceRegistry::pair(unsigned long device_id, uint16_t channels)
+{
+	int i = set_channels(device_id, channels);
+	if (i != -1)
+		devices[i].configured = true;
+	return i != -1 || !channels;
+}
+
+bool DeviceRegistry::restore(unsigned long device_id, uint16_t channels,
+			     uint16_t states, bool configured)
+{
+	int i = set_channels(device_id, channels);
+	if (i != -1) {
+		devices[i].states = states & channels;
+		devices[i].configured = configured;
+	}
+	return i != -1 || !channels;
+}
+
+uint16_t DeviceRegistry::channels(unsigned long device_id) const
+{
+	int i = index_of(device_id);
+	return i == -1 ? 0 : devices[i].channels;
+}
+
+uint16_t DeviceRegistry::configured(unsigned long device_id) const
+{
+	int i = index_of(device_id);
+	return i == -1 || !devices[i].configured ? 0 : devices[i].channels;
+}
+
+uint16_t DeviceRegistry::states(unsigned long device_id) const
+{
+	int i = index_of(device_id);
+	return i == -1 ? 0 : devices[i].states;
+}
+
+void DeviceRegistry::print(Print & out) const
+{
+	for (size_t i = 0; i < num_devices; ++i) {
+		out.print(F("DEV "));
+		out.print(devices[i].id, HEX);
+		out.print(F(": channels "));
+		out.print(devices[i].channels, HEX);
+		if (devices[i].configured)
+			out.print(F(" (paired)"));
+		out.print(F(", on "));
+		out.println(devices[i].states, HEX);
+	}
+}
+
+int DeviceRegistry::index_of(unsigned long device_id) const
+{
+	for (size_t i = 0; i < num_devices; ++i) {
+		if (devices[i].id == device_id)
+			return i;
+	}
+	return -1;
+}
+
+int DeviceRegistry::set_channels(unsigned long device_id, uint16_t channels)
+{
+	int i = index_of(device_id);
+	if (i == -1) {
+		if (!channels || num_devices == max_devices)
+			return -1;
+		i = num_devices++;
+		devices[i].id = device_id;
+		devices[i].states = 0;
+		devices[i].configured = false;
+	}
+	else if (!channels) { // forget device
+		devices[i] = devices[--num_devices];
+		return -1;
+	}
+	devices[i].channels = channels;
+	devices[i].states &= channels;
+	return i;
+}
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef NEXA_NODE_DUTY_CYCLE_H
+#define NEXA_NODE_DUTY_CYCLE_H
+
+#include "Macros.h"
+
+#include <limits.h>
+
+/*
+ * Band duty-cycle accounting, and token bucket limiter for the TX path.
+ *
+ * Transmissions are admitted by a token bucket: tokens (µs of airtime)
+ * accrue at the configured duty cycle, up to the given burst capacity,
+ * and each transmission consumes tokens equal to its airtime (see
+ * PulseSchedule::airtime()). A transmission that would exceed the duty
+ * cycle must be delayed (see wait_time()) or rejected.
+ *
+ * Independently, all admitted airtime is accounted for in a sliding
+ * window of num_buckets buckets of bucket_len ms each, from which the
+ * current band utilisation is computed.
+ *
+ * All times are passed in explicitly (ms), so that the limiter can be
+ * driven by a simulated clock.
+ */
+class DutyCycle {
+public: // types & constants
+	static const size_t num_buckets = 60;
+	static const unsigned long bucket_len = 60000; // ms
+	static const unsigned long window_len = num_buckets * bucket_len;
+
+public: // initializers
+	/*
+	 * Allow the given duty cycle (in permille), with bursts of up to
+	 * the given capacity (µs of airtime).
+	 */
+	DutyCycle(unsigned int permille, unsigned long capacity)
+		: permille(permille), capacity(capacity), tokens(capacity),
+		  last_refill(0), cur_bucket(0), bucket_start(0),
+		  num_admitted(0), num_delayed(0), num_rejected(0)
+	{
+		for (size_t i = 0; i < num_buckets; ++i)
+			buckets[i] = 0;
+	}
+
+public: // commands
+	// Change the allowed duty cycle (permille).
+	void set_permille(unsigned int p) { permille = p; }
+
+	/*
+	 * Try to admit a transmission of the given airtime (µs) at the
+	 * given time (ms). Return true, and account for the airtime, if
+	 * the transmission fits within the duty cycle. Otherwise return
+	 * false; the caller should then delay or reject the transmission.
+	 */
+	bool admit(unsigned long airtime, unsigned long now)
+	{
+		refill(now);
+		if (airtime > tokens)
+			return false;
+		tokens -= airtime;
+		account(airtime, now);
+		++num_admitted;
+		return true;
+	}
+
+	// Record that a transmission was delayed by the caller.
+	void defer() { ++num_delayed; }
+
+	// Record that a transmission was rejected by the caller.
+	void reject() { ++num_rejected; }
+
+public: // queries
+	/*
+	 * Return the time (ms) until a transmission of the given airtime
+	 * (µs) can be admitted, counted from the last call to admit(), or
+	 * ULONG_MAX if it never can.
+	 */
+	unsigned long wait_time(unsigned long airtime) const
+	{
+		if (airtime > capacity || !permille)
+			return ULONG_MAX;
+		if (airtime <= tokens)
+			return 0;
+		// tokens accrue at "permille" µs per ms
+		return (airtime - tokens + permille - 1) / permille;
+	}
+
+	/*
+	 * Return the utilisation (permille) of the band by our own
+	 * transmissions during the last window_len ms.
+	 */
+	unsigned int utilisation(unsigned long now)
+	{
+		account(0, now);
+		unsigned long sum = 0;
+		for (size_t i = 0; i < num_buckets; ++i)
+			sum += buckets[i];
+		// sum is µs, window is ms: permille = sum / window_len
+		return sum / window_len;
+	}
+
+	void print(Print & out)
+	{
+		out.print(F("<DutyCycle, limit = "));
+		out.print(permille);
+		out.print(F(" permille, tokens = "));
+		out.print(tokens / 1000);
+		out.print(F(" ms, admitted = "));
+		out.print(num_admitted);
+		out.print(F(", delayed = "));
+		out.print(num_delayed);
+		out.print(F(", rejected = "));
+		out.print(num_rejected);
+		out.println(F(">"));
+	}
+
+private: // helpers
+	void refill(unsigned long now)
+	{
+		unsigned long elapsed = now - last_refill;
+		last_refill = now;
+		unsigned long add = elapsed * permille;
+		if (permille && add / permille != elapsed) // overflow
+			add = capacity;
+		tokens = MIN(tokens + MIN(add, capacity), capacity);
+	}
+
+	// Add the given airtime (µs) to the bucket covering time now (ms).
+	void account(unsigned long airtime, unsigned long now)
+	{
+		unsigned long elapsed = (now - bucket_start) / bucket_len;
+		if (elapsed >= num_buckets) { // whole window has expired
+			for (size_t i = 0; i < num_buckets; ++i)
+				buckets[i] = 0;
+			bucket_start = now;
+		}
+		else {
+			for (; elapsed; --elapsed) {
+				cur_bucket = (cur_bucket + 1) % num_buckets;
+				buckets[cur_bucket] = 0;
+				bucket_start += bucket_len;
+			}
+		}
+		buckets[cur_bucket] += airtime;
+	}
+
+private: // representation
+	unsigned int permille;
+	const unsigned long capacity; // µs
+	unsigned long tokens; // µs
+	unsigned long last_refill; // ms
+
+	unsigned long buckets[num_buckets]; // µs of airtime per bucket
+	size_t cur_bucket;
+	unsigned long bucket_start; // ms
+
+	unsigned long num_admitted;
+	unsigned long num_delayed;
+	unsigned long num_rejected;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef NEXA_NODE_EEPROM_MEDIUM_H
+#define NEXA_NODE_EEPROM_MEDIUM_H
+
+#include "LogStore.h"
+
+/*
+ * StoreMedium on the Spark's emulated EEPROM (which is kept in flash by
+ * the system firmware).
+ *
+ * Each byte that is written may cost a flash write (and now and then a
+ * page erase, which stalls the CPU for tens of ms), so bytes that already
+ * hold the erased value are not erased again.
+ */
+class EepromMedium : public StoreMedium {
+public:
+	size_t size() const { return EEPROM.length(); }
+
+	void read(size_t addr, void * buf, size_t len) const
+	{
+		byte * p = (byte *) buf;
+		for (size_t i = 0; i < len; ++i)
+			p[i] = EEPROM.read(addr + i);
+	}
+
+	void write(size_t addr, const void * buf, size_t len)
+	{
+		const byte * p = (const byte *) buf;
+		for (size_t i = 0; i < len; ++i)
+			EEPROM.write(addr + i, p[i]);
+	}
+
+	void erase(size_t addr, size_t len)
+	{
+		for (size_t i = 0; i < len; ++i) {
+			if (EEPROM.read(addr + i) != 0xff)
+				EEPROM.write(addr + i, 0xff);
+		}
+	}
+};
+
+#endif
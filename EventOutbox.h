@@ -0,0 +1,120 @@
+#ifndef NEXA_NODE_EVENT_OUTBOX_H
+#define NEXA_NODE_EVENT_OUTBOX_H
+
+#include "Macros.h"
+#include "PackedCommand.h"
+
+/*
+ * Outbox of received commands, waiting to be published to the cloud.
+ *
+ * Received commands are posted as soon as they are decoded, whether or
+ * not the cloud is connected. The repetitions of a command within one
+ * burst (no more than burst_gap ms apart) are posted only once. While
+ * offline, events accumulate in the outbox; when it is full, the oldest
+ * event is dropped (and counted).
+ *
+ * Events are handed out by poll() no faster than one per
+ * publish_interval ms, to stay within the cloud's publish rate limit
+ * when a backlog is delivered after (re)connecting. The time at which
+ * each event was received is kept, so that the age of delivered events
+ * can be reported.
+ */
+class EventOutbox {
+public: // types & constants
+	static const size_t capacity = 16;
+
+	// Repetitions closer than this belong to the same burst (ms)
+	static const unsigned long burst_gap = 250;
+
+	// Minimum time between two published events (ms)
+	static const unsigned long publish_interval = 1000;
+
+	struct Event {
+		PackedCommand cmd;
+		unsigned long time; // ms
+	};
+
+public: // initializers
+	EventOutbox()
+		: head(0), len(0), last_cmd(), last_time(0), last_publish(0),
+		  published(false), post_count(0), publish_count(0),
+		  drop_count(0) { }
+
+public: // commands
+	// Post the given command, received at the given time (ms).
+	void post(PackedCommand cmd, unsigned long now);
+
+	/*
+	 * Retrieve the next event to be published at the given time (ms).
+	 *
+	 * Return false if there is nothing to publish, or if publishing
+	 * now would exceed the rate limit.
+	 */
+	bool poll(Event & event, unsigned long now);
+
+public: // queries
+	bool empty() const { return !len; }
+	size_t size() const { return len; }
+	unsigned long dropped() const { return drop_count; }
+
+	void print(Print & out) const
+	{
+		out.print(F("<EventOutbox, queued = "));
+		out.print(len);
+		out.print(F(", posted = "));
+		out.print(post_count);
+		out.print(F(", published = "));
+		out.print(publish_count);
+		out.print(F(", dropped = "));
+		out.print(drop_count);
+		out.println(F(">"));
+	}
+
+private: // representation
+	Event events[capacity]; // ring buffer, oldest at head
+	size_t head;
+	size_t len;
+	PackedCommand last_cmd; // last posted command, for burst detection
+	unsigned long last_time;
+	unsigned long last_publish;
+	bool published; // last_publish is valid
+
+	unsigned long post_count;
+	unsigned long publish_count;
+	unsigned long drop_count;
+};
+
+void EventOutbox::post(PackedCommand cmd, unsigned long now)
+{
+	bool repeat = cmd == last_cmd && now - last_time <= burst_gap;
+	last_cmd = cmd;
+	last_time = now;
+	if (repeat)
+		return;
+
+	if (len == capacity) { // drop oldest
+		head = (head + 1) % capacity;
+		--len;
+		++drop_count;
+	}
+	Event & e = events[(head + len) % capacity];
+	e.cmd = cmd;
+	e.time = now;
+	++len;
+	++post_count;
+}
+
+bool EventOutbox::poll(Event & event, unsigned long now)
+{
+	if (!len || (published && now - last_publish < publish_interval))
+		return false;
+	event = events[head];
+	head = (head + 1) % capacity;
+	--len;
+	last_publish = now;
+	published = true;
+	++publish_count;
+	return true;
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef NEXA_NODE_FRAME_CACHE_H
+#define NEXA_NODE_FRAME_CACHE_H
+
+#include "Macros.h"
+#include "NexaCommand.h"
+#include "PulseSchedule.h"
+
+/*
+ * Small least-recently-used cache of encoded Nexa commands.
+ *
+ * Looking up a command returns its PulseSchedule, encoding the command
+ * only if it is not already present in the cache. When the cache is full,
+ * the least recently used schedule is evicted.
+ *
+ * Hits and misses are counted, so that the effectiveness of the cache
+ * can be reported.
+ */
+template<size_t Slots>
+class FrameCache {
+public: // initializers
+	FrameCache() : clock(0), hit_count(0), miss_count(0)
+	{
+		for (size_t i = 0; i < Slots; ++i)
+			last_used[i] = 0; // never used => free
+	}
+
+public: // commands
+	// Return the (possibly freshly encoded) schedule for the given cmd.
+	const PulseSchedule & lookup(const NexaCommand & cmd)
+	{
+		PackedCommand key = cmd.pack();
+		size_t victim = 0;
+		for (size_t i = 0; i < Slots; ++i) {
+			if (last_used[i] && keys[i] == key) {
+				++hit_count;
+				last_used[i] = ++clock;
+				return scheds[i];
+			}
+			if (last_used[i] < last_used[victim])
+				victim = i;
+		}
+
+		++miss_count;
+		keys[victim] = key;
+		cmd.encode(scheds[victim]);
+		last_used[victim] = ++clock;
+		return scheds[victim];
+	}
+
+	// Forget all cached schedules.
+	void clear()
+	{
+		for (size_t i = 0; i < Slots; ++i)
+			last_used[i] = 0;
+	}
+
+public: // queries
+	unsigned long hits() const { return hit_count; }
+	unsigned long misses() const { return miss_count; }
+
+	// Return the hit rate in percent (0 if no lookups were made).
+	unsigned int hit_rate() const
+	{
+		unsigned long total = hit_count + miss_count;
+		return total ? hit_count * 100 / total : 0;
+	}
+
+	void print(Print & out) const
+	{
+		out.print(F("<FrameCache, slots = "));
+		out.print(Slots);
+		out.print(F(", hits = "));
+		out.print(hit_count);
+		out.print(F(", misses = "));
+		out.print(miss_count);
+		out.print(F(", hit rate = "));
+		out.print(hit_rate());
+		out.println(F("%>"));
+	}
+
+private: // representation
+	PackedCommand keys[Slots];
+	PulseSchedule scheds[Slots];
+	unsigned long last_used[Slots]; // LRU timestamps; 0 == free slot
+	unsigned long clock;
+	unsigned long hit_count;
+	unsigned long miss_count;
+};
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef NEXA_NODE_GROUP_PLANNER_H
+#define NEXA_NODE_GROUP_PLANNER_H
+
+#include "Macros.h"
+#include "NexaCommand.h"
+#include "DeviceRegistry.h"
+#include "PulseSchedule.h"
+#include "TxQueue.h"
+
+/*
+ * Rewrite batches of pending commands to use Nexa group commands.
+ *
+ * When the pending commands in a TxQueue set all paired channels (as
+ * set by DeviceRegistry::pair()) of a 32-bit device id to the same state,
+ * the per-channel commands are replaced by a single group command,
+ * which is transmitted in place of the first of them. Commands for
+ * channels that are not paired are left as they are.
+ *
+ * Channels that are only learned from traffic are not used: a group
+ * command would also switch any channel that has not been heard yet.
+ * A device is left alone if the batch contains anything else for it
+ * (commands with different states or repeat counts, or group commands),
+ * since collapsing would then change the order of the commands.
+ */
+class GroupPlanner {
+public: // initializers
+	GroupPlanner(const DeviceRegistry & registry)
+		: registry(registry), collapse_count(0), saved_frames(0),
+		  saved_us(0) { }
+
+public: // commands
+	// Collapse per-channel commands in the given queue, where possible.
+	void plan(TxQueue & queue);
+
+public: // queries
+	// Number of group commands substituted so far
+	unsigned long collapsed() const { return collapse_count; }
+
+	// Number of frames (including repetitions) not transmitted
+	unsigned long frames_saved() const { return saved_frames; }
+
+	// Total airtime (in ms) not spent thanks to group commands
+	unsigned long airtime_saved() const { return saved_us / 1000; }
+
+	void print(Print & out) const
+	{
+		out.print(F("<GroupPlanner, collapsed = "));
+		out.print(collapse_count);
+		out.print(F(", frames saved = "));
+		out.print(saved_frames);
+		out.print(F(", airtime saved = "));
+		out.print(airtime_saved());
+		out.println(F(" ms>"));
+	}
+
+private: // helpers
+	// Is e an ordinary per-channel command that may be collapsed?
+	static bool collapsible(const TxQueue::Entry & e)
+	{
+		return e.cmd.version == NexaCommand::NEXA_32BIT &&
+		       !e.cmd.group;
+	}
+
+	// Try to collapse the commands matching queue[first].
+	void collapse_from(TxQueue & queue, size_t first);
+
+private: // representation
+	const DeviceRegistry & registry;
+	unsigned long collapse_count;
+	unsigned long saved_frames;
+	unsigned long saved_us;
+};
+
+void GroupPlanner::plan(TxQueue & queue)
+{
+	for (size_t i = 0; i < queue.size(); ++i) {
+		if (collapsible(queue[i]))
+			collapse_from(queue, i);
+	}
+}
+
+void GroupPlanner::collapse_from(TxQueue & queue, size_t first)
+{
+	const TxQueue::Entry & head = queue[first];
+	unsigned long id = head.cmd.device_id();
+	uint16_t paired = registry.configured(id);
+	if (!paired || !(paired & (paired - 1)))
+		return; // less than two paired channels; nothing to gain
+
+	// Which paired channels are set by the batch?
+	uint16_t covered = 0;
+	for (size_t i = first; i < queue.size(); ++i) {
+		const TxQueue::Entry & e = queue[i];
+		if (e.cmd.version != head.cmd.version ||
+		    e.cmd.device_id() != id)
+			continue;
+		if (!collapsible(e) || e.cmd.state != head.cmd.state ||
+		    e.reps != head.reps)
+			return; // conflicting command for this device
+		covered |= 1 << e.cmd.channel;
+	}
+	if ((covered & paired) != paired)
+		return;
+
+	// The group command goes in place of the first paired command
+	while (queue[first].cmd.device_id() != id ||
+	       queue[first].cmd.version != head.cmd.version ||
+	       !(paired & 1 << queue[first].cmd.channel))
+		++first;
+
+	// Replace that command with group command, and drop the others
+	size_t removed = 0;
+	for (size_t i = queue.size() - 1; i > first; --i) {
+		const NexaCommand & cmd = queue[i].cmd;
+		if (collapsible(queue[i]) && cmd.version == head.cmd.version &&
+		    cmd.device_id() == id && (paired & 1 << cmd.channel)) {
+			queue.remove(i);
+			++removed;
+		}
+	}
+	TxQueue::Entry & e = queue[first];
+	e.cmd.group = true;
+	e.cmd.channel = 0;
+
+	PulseSchedule sched;
+	e.cmd.encode(sched);
+	++collapse_count;
+	saved_frames += removed * e.reps;
+	saved_us += removed * sched.airtime(e.reps);
+}
+
+#endif
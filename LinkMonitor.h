@@ -0,0 +1,232 @@
+#ifndef NEXA_NODE_LINK_MONITOR_H
+#define NEXA_NODE_LINK_MONITOR_H
+
+#include "Macros.h"
+#include "NexaCommand.h"
+#include "PulseParser.h"
+#include "RingBuffer.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Per-device link quality statistics, derived from received frames.
+ *
+ * For every decoded command, the corresponding FrameTiming record (as
+ * produced by the PulseParser) is merged into the running statistics of
+ * the sending device:
+ *  - mean SHORT/LONG/SYNC pulse lengths, compared to nominal values
+ *  - jitter (standard deviation) of the SHORT pulses
+ *  - repeats received out of repeats expected (a transmitter sends each
+ *    command several times in a burst)
+ *  - frames that were aborted after their SYNC; these are attributed to
+ *    the device of the next successfully decoded frame
+ *
+ * Statistics are kept incrementally, using constant memory per device.
+ * When the table is full, the least recently seen device is evicted.
+ */
+class LinkMonitor {
+public: // types & constants
+	static const size_t max_links = 8;
+
+	// Frames further apart than this belong to different bursts (ms)
+	static const unsigned long burst_gap = 250;
+
+public: // initializers
+	LinkMonitor(RingBuffer<FrameTiming> & timings, byte expected_reps = 5)
+		: timings(timings), expected_reps(expected_reps), num_links(0),
+		  pending_failures(0) { }
+
+public: // commands
+	/*
+	 * Account for the given command, which was just decoded at the
+	 * given time (ms).
+	 */
+	void update(const NexaCommand & cmd, unsigned long now);
+
+public: // queries
+	/*
+	 * Format a compact summary of all links into the given buffer,
+	 * one entry per device, separated by ';':
+	 *
+	 *     V:DDDDDD:dS,dL,dY:J:RX/EXP:F
+	 *
+	 * where dS/dL/dY are the deviations (µs) of the mean SHORT/LONG/
+	 * SYNC pulse lengths from their nominal values, J is the jitter
+	 * (µs) of the SHORT pulses, RX/EXP is repeats received/expected,
+	 * and F is the number of frames that failed after SYNC.
+	 *
+	 * Entries that do not fit in the buffer are skipped. Return the
+	 * length of the formatted string.
+	 */
+	size_t format(char * buf, size_t len) const;
+
+	void print(Print & out) const;
+
+	// Failed frames not (yet) attributed to any device
+	unsigned long unattributed_failures() const { return pending_failures; }
+
+private: // helpers
+	// Running mean/variance, using Welford's/Chan's algorithm
+	struct Stat {
+		unsigned long n;
+		float mean;
+		float m2;
+
+		// Merge nb samples with the given sum and sum of squares
+		void merge(unsigned long nb, unsigned long sum, uint64_t sumsq)
+		{
+			if (!nb)
+				return;
+			float mean_b = float(sum) / nb;
+			// exact in integers, avoids cancellation in float
+			float m2_b = float(sumsq - (uint64_t) sum * sum / nb);
+			float delta = mean_b - mean;
+			unsigned long nab = n + nb;
+			mean += delta * nb / nab;
+			m2 += m2_b + delta * delta * n * nb / nab;
+			n = nab;
+		}
+
+		// Deviation of mean (1/16 µs) from nominal (µs), in µs
+		long deviation(long nominal) const
+		{
+			return n ? long(mean / 16 + 0.5f) - nominal : 0;
+		}
+
+		// Standard deviation in µs
+		long stddev() const
+		{
+			return n > 1 ? long(sqrtf(m2 / n) / 16 + 0.5f) : 0;
+		}
+	};
+
+	struct Link {
+		Stat pulse[FrameTiming::NUM_CLASSES];
+		Stat sync;
+		unsigned long received;
+		unsigned long expected;
+		unsigned long failures;
+		PackedCommand last_cmd; // identifies the device (never 0)
+		unsigned long last_seen;
+		byte burst_frames;
+	};
+
+	// Return the link for the given command, (re)using a slot if needed
+	Link & link_for(PackedCommand cmd, unsigned long now);
+
+	// Nominal pulse lengths (µs) of the given version
+	static long nominal_short(unsigned v)
+	{
+		return v == NexaCommand::NEXA_12BIT ? 350 : 310;
+	}
+	static long nominal_long(unsigned v)
+	{
+		return v == NexaCommand::NEXA_12BIT ? 1050 : 1236;
+	}
+	static long nominal_sync(unsigned v)
+	{
+		return v == NexaCommand::NEXA_12BIT ? 10850 : 10150;
+	}
+
+private: // representation
+	RingBuffer<FrameTiming> & timings;
+	const byte expected_reps;
+	Link links[max_links];
+	size_t num_links;
+	unsigned long pending_failures;
+};
+
+void LinkMonitor::update(const NexaCommand & cmd, unsigned long now)
+{
+	PackedCommand packed = cmd.pack();
+	Link & link = link_for(packed, now);
+
+	// Find timing of this frame, and any failures preceding it
+	while (!timings.r_empty()) {
+		FrameTiming t = timings.r_pop();
+		if (!t.complete) {
+			++pending_failures;
+			continue;
+		}
+		for (size_t c = 0; c < FrameTiming::NUM_CLASSES; ++c)
+			link.pulse[c].merge(t.n[c], t.sum[c], t.sumsq[c]);
+		link.sync.merge(1, t.sync, (uint64_t) t.sync * t.sync);
+		break;
+	}
+	link.failures += pending_failures;
+	pending_failures = 0;
+
+	// Count repeats within the current burst
+	if (link.last_cmd != packed || now - link.last_seen > burst_gap ||
+	    !link.expected) {
+		link.expected += expected_reps;
+		link.burst_frames = 0;
+	}
+	if (link.burst_frames < expected_reps) {
+		++link.burst_frames;
+		++link.received;
+	}
+	link.last_cmd = packed;
+	link.last_seen = now;
+}
+
+size_t LinkMonitor::format(char * buf, size_t len) const
+{
+	size_t pos = 0;
+	if (len)
+		buf[0] = '\0';
+	for (size_t i = 0; i < num_links; ++i) {
+		const Link & l = links[i];
+		unsigned v = l.last_cmd.version();
+		char entry[64];
+		int n = snprintf(entry, sizeof(entry),
+			"%X:%06lX:%+ld,%+ld,%+ld:%ld:%lu/%lu:%lu;",
+			v, (unsigned long) l.last_cmd.device_id(),
+			l.pulse[FrameTiming::SHORT_HIGH].deviation(
+				nominal_short(v)),
+			l.pulse[FrameTiming::LONG_LOW].deviation(
+				nominal_long(v)),
+			l.sync.deviation(nominal_sync(v)),
+			l.pulse[FrameTiming::SHORT_HIGH].stddev(),
+			l.received, l.expected, l.failures);
+		if (n < 0 || pos + n >= len)
+			continue;
+		memcpy(buf + pos, entry, n + 1);
+		pos += n;
+	}
+	return pos;
+}
+
+void LinkMonitor::print(Print & out) const
+{
+	char buf[max_links * 64];
+	format(buf, sizeof(buf));
+	out.print(F("LINKS "));
+	out.println(buf);
+}
+
+LinkMonitor::Link & LinkMonitor::link_for(PackedCommand cmd,
+					  unsigned long now)
+{
+	uint32_t key = cmd.device_key();
+	size_t victim = 0;
+	for (size_t i = 0; i < num_links; ++i) {
+		if (links[i].last_cmd.device_key() == key)
+			return links[i];
+		if (now - links[i].last_seen > now - links[victim].last_seen)
+			victim = i;
+	}
+	if (num_links < max_links)
+		victim = num_links++;
+
+	Link & link = links[victim];
+	link = Link(); // zero-initialized
+	link.last_cmd = cmd;
+	link.last_seen = now;
+	return link;
+}
+
+#endif
@@ -0,0 +1,416 @@
+#ifndef NEXA_NODE_LOG_STORE_H
+#define NEXA_NODE_LOG_STORE_H
+
+#include "Macros.h"
+
+#include <string.h>
+
+/*
+ * Byte-addressable persistent medium (emulated EEPROM, flash, or a RAM
+ * mock), as used by LogStore. Erased bytes read as 0xff.
+ */
+class StoreMedium {
+public:
+	virtual ~StoreMedium() { }
+
+	// Return the size of the medium in bytes.
+	virtual size_t size() const = 0;
+
+	virtual void read(size_t addr, void * buf, size_t len) const = 0;
+	virtual void write(size_t addr, const void * buf, size_t len) = 0;
+
+	// Return the given range to the erased state (all 0xff).
+	virtual void erase(size_t addr, size_t len) = 0;
+};
+
+/*
+ * Small log-structured key/value store on a StoreMedium.
+ *
+ * The medium is divided into equally sized segments, of which one is
+ * current at any time. Records are only ever appended to the current
+ * segment:
+ *
+ *     LEN KEY KEY KEY KEY VALUE... CRC CRC
+ *
+ * where LEN is the length of the value (0 == the key was removed), KEY
+ * is the 32-bit key (little-endian), and CRC is a CRC-16 of the rest of
+ * the record. The latest record of a key is its current value. A segment
+ * starts with a header holding a 16-bit generation number; the valid
+ * segment with the highest generation is the current one.
+ *
+ * When the current segment is full, the current value of every key is
+ * copied into the next segment, which becomes current once its header
+ * has been written (compaction). Segments are used round-robin, which
+ * spreads the wear over the whole medium. A put that would not fit even
+ * after compaction fails up front, without touching the medium, so the
+ * current values must fit in capacity() bytes, with room to spare.
+ *
+ * Every write leaves the store consistent at every byte: a record that
+ * was cut short (by a reset or power loss) fails its CRC, and is ignored
+ * along with anything after it; a segment that was being compacted into
+ * has no valid header (or an older generation), so the previous segment
+ * remains current. Either way, the store comes back with the values as
+ * of the last complete write.
+ *
+ * The location of the current record of each key is kept in a small
+ * index in RAM, which is rebuilt by mount() at boot with a single pass
+ * over the current segment.
+ */
+class LogStore {
+public: // types & constants
+	static const size_t max_keys = 48;
+	static const size_t max_value = 64; // bytes per value
+
+	static const size_t header_size = 5; // MAGIC GEN GEN CRC CRC
+	static const size_t record_overhead = 7; // LEN KEY*4 CRC*2
+	static const size_t value_offset = 5; // within a record
+	static const byte magic = 0xa5; // first byte of segment header
+
+public: // initializers
+	LogStore(StoreMedium & medium, size_t num_segments)
+		: medium(medium), num_segments(MAX(num_segments, (size_t) 2)),
+		  seg_size(medium.size() / this->num_segments),
+		  current(false), active(0), gen(0), tail(0), num_keys(0),
+		  live(0), num_records(0), num_compactions(0), num_torn(0),
+		  num_errors(0) { }
+
+	/*
+	 * Find the current segment, and index its records. Must be called
+	 * before any other method.
+	 *
+	 * Return the number of keys found.
+	 */
+	size_t mount();
+
+public: // commands
+	/*
+	 * Set the value of the given key to the len bytes at value. A
+	 * zero-length value removes the key. Nothing is written if the key
+	 * already has the given value.
+	 *
+	 * Return false if the value is too large, if there is no room for
+	 * another key, or if the current values and the new value together
+	 * would not fit in a segment (in which case nothing is written).
+	 */
+	bool put(uint32_t key, const void * value, size_t len);
+
+	bool remove(uint32_t key) { return put(key, NULL, 0); }
+
+	// Copy the current values into the next segment.
+	void compact();
+
+public: // queries
+	/*
+	 * Copy the value of the given key into buf (at most len bytes).
+	 *
+	 * Return the length of the value, or 0 if the key is not found.
+	 */
+	size_t get(uint32_t key, void * buf, size_t len) const;
+
+	// Return true if the given key already has the given value.
+	bool holds(uint32_t key, const void * value, size_t len) const;
+
+	/*
+	 * Return true if a value of the given length can be put without
+	 * compacting first.
+	 */
+	bool fits(size_t len) const
+	{
+		return record_overhead + len <= free_space();
+	}
+
+	// Return the number of keys, and the i-th key (in no particular order)
+	size_t size() const { return num_keys; }
+	uint32_t key_at(size_t i) const { return index[i].key; }
+
+	// Return the number of bytes left in the current segment.
+	size_t free_space() const
+	{
+		return current ? seg_start(active) + seg_size - tail : 0;
+	}
+
+	// Return the number of bytes available for records in a segment.
+	size_t capacity() const { return seg_size - header_size; }
+
+	unsigned long compactions() const { return num_compactions; }
+
+	void print(Print & out) const;
+
+private: // helpers
+	size_t seg_start(size_t seg) const { return seg * seg_size; }
+
+	// Return true if the given segment has a valid header.
+	bool read_header(size_t seg, uint16_t & generation) const;
+	void write_header(size_t seg, uint16_t generation);
+
+	/*
+	 * Read the header of the record at addr (which must end before
+	 * end). Return the size of the record, or 0 if there is no valid
+	 * record at addr.
+	 */
+	size_t read_record(size_t addr, size_t end,
+			   uint32_t & key, byte & len) const;
+
+	int index_of(uint32_t key) const;
+	void set_index(int i, uint32_t key, size_t addr, byte len);
+
+	static uint16_t crc16(uint16_t crc, const byte * buf, size_t len);
+
+private: // representation
+	StoreMedium & medium;
+	const size_t num_segments;
+	const size_t seg_size;
+
+	bool current; // there is a current segment
+	size_t active; // current segment
+	uint16_t gen; // generation of current segment
+	size_t tail; // address of next record
+
+	struct Entry {
+		uint32_t key;
+		uint16_t addr; // of current record
+		byte len; // of current value
+	} index[max_keys];
+	size_t num_keys;
+	size_t live; // total size of the current records
+
+	unsigned long num_records; // # of records written
+	unsigned long num_compactions;
+	unsigned long num_torn; // # of broken records found by mount()
+	unsigned long num_errors; // # of failed puts
+};
+
+size_t LogStore::mount()
+{
+	current = false;
+	num_keys = 0;
+	live = 0;
+	for (size_t seg = 0; seg < num_segments; ++seg) {
+		uint16_t g;
+		if (read_header(seg, g) && (!current || int16_t(g - gen) > 0)) {
+			current = true;
+			active = seg;
+			gen = g;
+		}
+	}
+	if (!current)
+		return 0;
+
+	size_t end = seg_start(active) + seg_size;
+	size_t addr = seg_start(active) + header_size;
+	uint32_t key;
+	byte len;
+	while (size_t n = read_record(addr, end, key, len)) {
+		int i = index_of(key);
+		if (i == -1 && len && num_keys == max_keys)
+			++num_errors;
+		else
+			set_index(i, key, addr, len);
+		addr += n;
+	}
+	tail = addr;
+
+	byte b = 0xff;
+	if (addr < end)
+		medium.read(addr, &b, 1);
+	if (b != 0xff) { // broken record; compact before the next write
+		++num_torn;
+		tail = end;
+	}
+	return num_keys;
+}
+
+bool LogStore::put(uint32_t key, const void * value, size_t len)
+{
+	int i = index_of(key);
+	if (i == -1 && !len)
+		return true; // nothing to remove
+	if (len > max_value || (i == -1 && num_keys == max_keys)) {
+		++num_errors;
+		return false;
+	}
+
+	if (holds(key, value, len))
+		return true;
+
+	byte rec[record_overhead + max_value];
+	size_t n = record_overhead + len;
+	rec[0] = len;
+	for (size_t j = 0; j < 4; ++j)
+		rec[1 + j] = key >> (8 * j);
+	if (len)
+		memcpy(rec + value_offset, value, len);
+	uint16_t crc = crc16(0xffff, rec, n - 2);
+	rec[n - 2] = crc;
+	rec[n - 1] = crc >> 8;
+
+	if (n > free_space()) {
+		// Compaction copies the current records, including the one
+		// being replaced, before the new record is appended
+		if (live + n > capacity()) {
+			++num_errors;
+			return false;
+		}
+		compact();
+	}
+	medium.write(tail, rec, n);
+	set_index(i, key, tail, len);
+	tail += n;
+	++num_records;
+	return true;
+}
+
+void LogStore::compact()
+{
+	size_t seg = current ? (active + 1) % num_segments : 0;
+	size_t addr = seg_start(seg) + header_size;
+	medium.erase(seg_start(seg), seg_size);
+
+	byte rec[record_overhead + max_value];
+	for (size_t i = 0; i < num_keys; ++i) {
+		size_t n = record_overhead + index[i].len;
+		medium.read(index[i].addr, rec, n);
+		medium.write(addr, rec, n);
+		index[i].addr = addr;
+		addr += n;
+	}
+
+	// The new segment only becomes current once its header is written
+	gen = current ? gen + 1 : 0;
+	write_header(seg, gen);
+	current = true;
+	active = seg;
+	tail = addr;
+	++num_compactions;
+}
+
+bool LogStore::holds(uint32_t key, const void * value, size_t len) const
+{
+	int i = index_of(key);
+	if (i == -1)
+		return !len;
+	if (index[i].len != len)
+		return false;
+	byte buf[max_value];
+	medium.read(index[i].addr + value_offset, buf, len);
+	return memcmp(buf, value, len) == 0;
+}
+
+size_t LogStore::get(uint32_t key, void * buf, size_t len) const
+{
+	int i = index_of(key);
+	if (i == -1)
+		return 0;
+	medium.read(index[i].addr + value_offset, buf,
+		    MIN(len, (size_t) index[i].len));
+	return index[i].len;
+}
+
+void LogStore::print(Print & out) const
+{
+	out.print(F("<LogStore, segment = "));
+	out.print(active);
+	out.print(F("/"));
+	out.print(num_segments);
+	out.print(F(", generation = "));
+	out.print(gen);
+	out.print(F(", keys = "));
+	out.print(num_keys);
+	out.print(F(", live = "));
+	out.print(live);
+	out.print(F("/"));
+	out.print(capacity());
+	out.print(F(", free = "));
+	out.print(free_space());
+	out.print(F(", records = "));
+	out.print(num_records);
+	out.print(F(", compactions = "));
+	out.print(num_compactions);
+	out.print(F(", torn = "));
+	out.print(num_torn);
+	out.print(F(", errors = "));
+	out.print(num_errors);
+	out.println(F(">"));
+}
+
+bool LogStore::read_header(size_t seg, uint16_t & generation) const
+{
+	byte h[header_size];
+	medium.read(seg_start(seg), h, header_size);
+	if (h[0] != magic ||
+	    crc16(0xffff, h, 3) != (h[3] | h[4] << 8))
+		return false;
+	generation = h[1] | h[2] << 8;
+	return true;
+}
+
+void LogStore::write_header(size_t seg, uint16_t generation)
+{
+	byte h[header_size] = { magic, byte(generation),
+				byte(generation >> 8) };
+	uint16_t crc = crc16(0xffff, h, 3);
+	h[3] = crc;
+	h[4] = crc >> 8;
+	medium.write(seg_start(seg), h, header_size);
+}
+
+size_t LogStore::read_record(size_t addr, size_t end,
+			     uint32_t & key, byte & len) const
+{
+	byte rec[record_overhead + max_value];
+	if (addr + record_overhead > end)
+		return 0;
+	medium.read(addr, rec, 1);
+	size_t n = record_overhead + rec[0];
+	if (rec[0] > max_value || addr + n > end)
+		return 0;
+	medium.read(addr + 1, rec + 1, n - 1);
+	if (crc16(0xffff, rec, n - 2) != (rec[n - 2] | rec[n - 1] << 8))
+		return 0;
+	len = rec[0];
+	key = (uint32_t) rec[1] | (uint32_t) rec[2] << 8 |
+	      (uint32_t) rec[3] << 16 | (uint32_t) rec[4] << 24;
+	return n;
+}
+
+int LogStore::index_of(uint32_t key) const
+{
+	for (size_t i = 0; i < num_keys; ++i) {
+		if (index[i].key == key)
+			return i;
+	}
+	return -1;
+}
+
+void LogStore::set_index(int i, uint32_t key, size_t addr, byte len)
+{
+	if (i != -1)
+		live -= record_overhead + index[i].len;
+	if (!len) { // removed
+		if (i != -1)
+			index[i] = index[--num_keys];
+		return;
+	}
+	if (i == -1)
+		i = num_keys++;
+	live += record_overhead + len;
+	index[i].key = key;
+	index[i].addr = addr;
+	index[i].len = len;
+}
+
+/*
+ * CRC-16/CCITT (polynomial 0x1021), bitwise; records are short, and
+ * written rarely, so a lookup table is not worth its flash.
+ */
+uint16_t LogStore::crc16(uint16_t crc, const byte * buf, size_t len)
+{
+	while (len--) {
+		crc ^= (uint16_t) *buf++ << 8;
+		for (int i = 0; i < 8; ++i)
+			crc = crc & 0x8000 ? crc << 1 ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+#endif
@@ -2,7 +2,9 @@
 #define NEXA_NODE_NEXA_COMMAND_H
 
 #include "Macros.h"
+#include "PackedCommand.h"
 #include "RF433Transceiver.h"
+#include "PulseSchedule.h"
 #include "RingBuffer.h"
 #include "HexUtils.h"
 
@@ -24,6 +26,20 @@ public: // types & constants
 	// length of command string on format "V:DDDDDD:G:C:S"
 	static const size_t cmd_str_len = 14;
 
+	/*
+	 * State of a partially received command (see from_bit_buffer()).
+	 * Each stream of parsed bits needs its own state.
+	 */
+	struct BitState {
+		BitState() : version(NEXA_INVAL), bits(0), count(0), expect(0)
+		{ }
+
+		Version version;
+		uint32_t bits; // bits received so far, last one in the LSB
+		byte count; // # of bits received
+		byte expect; // # of bits in the command (0 == no command)
+	};
+
 public: // initializers
 	/*
 	 * Initialize NexaCommand instance from incoming command string
@@ -49,14 +65,61 @@ public: // initializers
 	 *
 	 * This factory will not initalize the given NexaCommand instance
 	 * every time it's called, but when it does, it will return true.
+	 *
+	 * The partially received command is kept in the given state
+	 * between calls. Without a state, a single shared state is used,
+	 * which is only suitable for a single ring buffer.
 	 */
 	static bool from_bit_buffer(NexaCommand & cmd,
-				    RingBuffer<char> & rx_bits);
+				    RingBuffer<char> & rx_bits,
+				    BitState & state);
+	static bool from_bit_buffer(NexaCommand & cmd,
+				    RingBuffer<char> & rx_bits)
+	{
+		static BitState state;
+		return from_bit_buffer(cmd, rx_bits, state);
+	}
+
+	// Initialize NexaCommand instance from its packed representation.
+	static void from_packed(NexaCommand & cmd, PackedCommand packed);
 
 public: // queries
+	// Return the packed representation of this command.
+	PackedCommand pack() const
+	{
+		return PackedCommand::make(version, device_id(), group,
+					   channel, state);
+	}
+
+	// Return true iff the given command has identical fields.
+	bool operator==(const NexaCommand & other) const
+	{
+		return pack() == other.pack();
+	}
+	bool operator!=(const NexaCommand & other) const
+	{
+		return !(*this == other);
+	}
+
+	// Return the 24-bit device id as a single integer.
+	unsigned long device_id() const
+	{
+		return (unsigned long) device[0] << 16 |
+		       (unsigned long) device[1] << 8 | device[2];
+	}
+
 	// Print this Nexa command on the serial port.
 	void print(Print & out) const;
 
+	/*
+	 * Encode this Nexa command into the given pulse schedule.
+	 *
+	 * Any previous contents of the schedule are discarded. The
+	 * resulting schedule can be played any number of times (see
+	 * PulseSchedule::play()) without re-encoding the command.
+	 */
+	void encode(PulseSchedule & sched) const;
+
 	/*
 	 * Transmit this Nexa command on the given RF transmitter.
 	 */
@@ -65,29 +128,21 @@ public: // queries
     String to_cmd_str() const;
 
 private: // helpers
-	void tx_12bit(RF433Transceiver & rf_port, size_t reps) const;
-	void tx_32bit(RF433Transceiver & rf_port, size_t reps) const;
-
-	/*
-	 * Convert the given array of 8 '0' or '1' characters into a byte.
-	 *
-	 * The character-encoded 'bits' are interpreted as LSB-first, and
-	 * the corresponding byte value is returned.
-	 */
-	static byte charbits2byte(const char bits[8]);
+	void enc_12bit(PulseSchedule & sched) const;
+	void enc_32bit(PulseSchedule & sched) const;
 
 	/*
-	 * Initialize this object from the 12/32 bits in the given buf.
+	 * Initialize this object from the given 12/32 frame bits, where
+	 * the first bit received is the MSB.
 	 *
-	 * No input validation is performed. The given buf is assumed to
-	 * contain 12/32 '0' or '1' characters.
+	 * No input validation is performed.
 	 *
 	 * The command bits are of the form:
 	 *  - 12-bit format: DDDDDDDD011S
 	 *  - 32-bit format: DDDDDDDDDDDDDDDDDDDDDDDD10GSCCCC
 	 */
-	void from_12bit_cmd(const char buf[12]);
-	void from_32bit_cmd(const char buf[32]);
+	void from_12bit_cmd(uint16_t frame);
+	void from_32bit_cmd(uint32_t frame);
 
 public: // representation
 	Version version;
@@ -113,7 +168,7 @@ bool NexaCommand::from_cmd_str(NexaCommand & cmd,
 	int c = Hex::parse_digit(buf[11]);
 	int s = Hex::parse_digit(buf[13]);
 
-	if ((v <= NEXA_INVAL && v >= NEXA_END) || !d ||
+	if (v <= NEXA_INVAL || v >= NEXA_END || !d ||
 	    (g != 1 && g != 0) || c == -1 || (s != 1 && s != 0))
 		return false;
 
@@ -145,43 +200,53 @@ String NexaCommand::to_cmd_str() const
 }
 
 bool NexaCommand::from_bit_buffer(NexaCommand & cmd,
-				  RingBuffer<char> & rx_bits)
+				  RingBuffer<char> & rx_bits,
+				  BitState & state)
 {
-	static Version version = NEXA_INVAL;
-	static char buf[32]; // Long enough for the longest command
-	static size_t buf_pos = 0;
-	static size_t expect = 0;
 	while (!rx_bits.r_empty()) {
 		char b = rx_bits.r_pop();
 		if (b == 'A' || b == 'B') {
-			buf_pos = 0;
+			state.bits = 0;
+			state.count = 0;
 			if (b == 'A') {
-				version = NEXA_32BIT;
-				expect = 32;
+				state.version = NEXA_32BIT;
+				state.expect = 32;
 			}
 			else {
-				version = NEXA_12BIT;
-				expect = 12;
+				state.version = NEXA_12BIT;
+				state.expect = 12;
 			}
 		}
-		else if ((b == '0' || b == '1') && buf_pos < expect)
-			buf[buf_pos++] = b;
-
-		if (expect && buf_pos == expect) { // all bits present
-			if (version == NEXA_12BIT)
-				cmd.from_12bit_cmd(buf);
-			else if (version == NEXA_32BIT)
-				cmd.from_32bit_cmd(buf);
-
-			expect = 0;
-			buf_pos = 0;
-			version = NEXA_INVAL;
+		else if ((b == '0' || b == '1') && state.count < state.expect) {
+			state.bits = state.bits << 1 | (b == '1');
+			++state.count;
+		}
+
+		if (state.expect && state.count == state.expect) { // all bits
+			if (state.version == NEXA_12BIT)
+				cmd.from_12bit_cmd(state.bits);
+			else if (state.version == NEXA_32BIT)
+				cmd.from_32bit_cmd(state.bits);
+
+			state = BitState();
 			return true;
 		}
 	}
 	return false;
 }
 
+void NexaCommand::from_packed(NexaCommand & cmd, PackedCommand packed)
+{
+	unsigned long id = packed.device_id();
+	cmd.version = (Version) packed.version();
+	cmd.device[0] = id >> 16;
+	cmd.device[1] = id >> 8;
+	cmd.device[2] = id;
+	cmd.channel = packed.channel();
+	cmd.group = packed.group();
+	cmd.state = packed.state();
+}
+
 void NexaCommand::print(Print & out) const
 {
 	const size_t device_bytes = 3;
@@ -198,12 +263,20 @@ void NexaCommand::print(Print & out) const
 	out.println(state ? '1' : '0');
 }
 
-void NexaCommand::transmit(RF433Transceiver & rf_port, size_t reps) const
+void NexaCommand::encode(PulseSchedule & sched) const
 {
+	sched.clear();
 	if (version == NEXA_12BIT)
-		tx_12bit(rf_port, reps);
+		enc_12bit(sched);
 	else
-		tx_32bit(rf_port, reps);
+		enc_32bit(sched);
+}
+
+void NexaCommand::transmit(RF433Transceiver & rf_port, size_t reps) const
+{
+	PulseSchedule sched;
+	encode(sched);
+	sched.play(rf_port, reps);
 
 #if DEBUG
 	Serial.print(F("Transmitted code: "));
@@ -211,7 +284,7 @@ void NexaCommand::transmit(RF433Transceiver & rf_port, size_t reps) const
 #endif
 }
 
-void NexaCommand::tx_12bit(RF433Transceiver & rf_port, size_t reps) const
+void NexaCommand::enc_12bit(PulseSchedule & sched) const
 {
 	/*
 	 * SYNC: SHORT (0.35ms) HIGH, XXLONG (10.9ms) LOW
@@ -224,41 +297,34 @@ void NexaCommand::tx_12bit(RF433Transceiver & rf_port, size_t reps) const
 		XXLONG = 31 * 350,
 	};
 
-	int bits[12]; // DDDDDDDD011S
-	// The 8 device bits are device[2] LSB first
-	for (size_t i = 0; i < 8; ++i)
-		bits[i] = device[2] >> i & 1;
-	bits[8] = 0;
-	bits[9] = 1;
-	bits[10] = 1;
-	bits[11] = state;
-
-	for (size_t i = 0; i < reps; ++i) {
-		// SYNC
-		rf_port.transmit(HIGH, SHORT);
-		rf_port.transmit(LOW, XXLONG);
-
-		// data bits
-		for (size_t i = 0; i < ARRAY_LENGTH(bits); ++i) {
-			if (bits[i]) { // '1'
-				rf_port.transmit(HIGH, SHORT);
-				rf_port.transmit(LOW, LONG);
-				rf_port.transmit(HIGH, LONG);
-				rf_port.transmit(LOW, SHORT);
-			}
-			else { // '0'
-				rf_port.transmit(HIGH, SHORT);
-				rf_port.transmit(LOW, LONG);
-				rf_port.transmit(HIGH, SHORT);
-				rf_port.transmit(LOW, LONG);
-			}
+	// DDDDDDDD011S, first bit in bit 11
+	uint16_t frame = pack().to_12bit_frame();
+
+	// SYNC
+	sched.append(SHORT);
+	sched.append(-XXLONG);
+
+	// data bits
+	for (int i = 11; i >= 0; --i) {
+		if (frame >> i & 1) { // '1'
+			sched.append(SHORT);
+			sched.append(-LONG);
+			sched.append(LONG);
+			sched.append(-SHORT);
+		}
+		else { // '0'
+			sched.append(SHORT);
+			sched.append(-LONG);
+			sched.append(SHORT);
+			sched.append(-LONG);
 		}
 	}
-	rf_port.transmit(HIGH, SHORT);
-	rf_port.transmit(LOW);
+
+	// trailing pulse, after the last repetition
+	sched.append_tail(SHORT);
 }
 
-void NexaCommand::tx_32bit(RF433Transceiver & rf_port, size_t reps) const
+void NexaCommand::enc_32bit(PulseSchedule & sched) const
 {
 	/*
 	 * SYNC: XXLONG (10.15ms) LOW, SHORT (0.31ms) HIGH,
@@ -276,80 +342,46 @@ void NexaCommand::tx_32bit(RF433Transceiver & rf_port, size_t reps) const
 		XXLONG = 10150,
 	};
 
-	int bits[32]; // DDDDDDDDDDDDDDDDDDDDDDDD10GSCCCC
-	// The 24 device bits are device[2..0] LSB first
-	for (size_t i = 0; i < 24; ++i)
-		bits[i] = device[2 - i / 8] >> (i % 8) & 1;
-	bits[24] = 1;
-	bits[25] = 0;
-	bits[26] = group;
-	bits[27] = state;
-	bits[28] = channel & 0b1000;
-	bits[29] = channel & 0b100;
-	bits[30] = channel & 0b10;
-	bits[31] = channel & 0b1;
-
-	for (size_t i = 0; i < reps; ++i) {
-		// SYNC
-		rf_port.transmit(LOW, XXLONG);
-		rf_port.transmit(HIGH, SHORT);
-		rf_port.transmit(LOW, XLONG);
-		rf_port.transmit(HIGH, SHORT);
-
-		// data bits
-		for (size_t i = 0; i < ARRAY_LENGTH(bits); ++i) {
-			if (bits[i]) { // '1'
-				rf_port.transmit(LOW, LONG);
-				rf_port.transmit(HIGH, SHORT);
-				rf_port.transmit(LOW, XSHORT);
-				rf_port.transmit(HIGH, SHORT);
-			}
-			else { // '0'
-				rf_port.transmit(LOW, XSHORT);
-				rf_port.transmit(HIGH, SHORT);
-				rf_port.transmit(LOW, LONG);
-				rf_port.transmit(HIGH, SHORT);
-			}
+	// DDDDDDDDDDDDDDDDDDDDDDDD10GSCCCC, first bit in bit 31
+	uint32_t frame = pack().to_32bit_frame();
+
+	// SYNC
+	sched.append(-XXLONG);
+	sched.append(SHORT);
+	sched.append(-XLONG);
+	sched.append(SHORT);
+
+	// data bits
+	for (int i = 31; i >= 0; --i) {
+		if (frame >> i & 1) { // '1'
+			sched.append(-LONG);
+			sched.append(SHORT);
+			sched.append(-XSHORT);
+			sched.append(SHORT);
+		}
+		else { // '0'
+			sched.append(-XSHORT);
+			sched.append(SHORT);
+			sched.append(-LONG);
+			sched.append(SHORT);
 		}
 	}
-	rf_port.transmit(LOW);
-}
-
-byte NexaCommand::charbits2byte(const char bits[8])
-{
-	return (bits[7] == '1' ? 1 : 0) << 7 |
-	       (bits[6] == '1' ? 1 : 0) << 6 |
-	       (bits[5] == '1' ? 1 : 0) << 5 |
-	       (bits[4] == '1' ? 1 : 0) << 4 |
-	       (bits[3] == '1' ? 1 : 0) << 3 |
-	       (bits[2] == '1' ? 1 : 0) << 2 |
-	       (bits[1] == '1' ? 1 : 0) << 1 |
-	       (bits[0] == '1' ? 1 : 0);
 }
 
-void NexaCommand::from_12bit_cmd(const char buf[12])
+void NexaCommand::from_12bit_cmd(uint16_t frame)
 {
-	version = NEXA_12BIT;
-	device[0] = 0;
-	device[1] = 0;
-	device[2] = charbits2byte(buf);
-	channel = 0;
-	group = 0;
-	state = buf[11] == '1';
+	// The constant "011" bits are not validated here
+	PackedCommand p = PackedCommand::from_12bit_frame(
+		(frame & ~0b1110) | 0b0110);
+	from_packed(*this, p);
 }
 
-void NexaCommand::from_32bit_cmd(const char buf[32])
+void NexaCommand::from_32bit_cmd(uint32_t frame)
 {
-	version = NEXA_32BIT;
-	device[0] = charbits2byte(buf + 16);
-	device[1] = charbits2byte(buf + 8);
-	device[2] = charbits2byte(buf);
-	channel = (buf[28] == '1' ? 0b1000 : 0) |
-	          (buf[29] == '1' ? 0b100 : 0) |
-	          (buf[30] == '1' ? 0b10 : 0) |
-	          (buf[31] == '1' ? 0b1 : 0);
-	group = buf[26] == '1';
-	state = buf[27] == '1';
+	// The constant "10" bits are not validated here
+	PackedCommand p = PackedCommand::from_32bit_frame(
+		(frame & ~0xc0UL) | 0x80UL);
+	from_packed(*this, p);
 }
 
 #endif
@@ -0,0 +1,103 @@
+#ifndef NEXA_NODE_OUTPUT_RING_H
+#define NEXA_NODE_OUTPUT_RING_H
+
+#include "Macros.h"
+
+/*
+ * Preallocated, non-blocking output buffer for serial reporting.
+ *
+ * This is a Print, so anything that prints itself (NexaCommand::print(),
+ * statistics, etc.) can format into it instead of directly onto the
+ * serial port. Formatting into the ring never blocks and never allocates;
+ * the contents are drained separately (see drain()), in chunks as large
+ * as the output has room for.
+ *
+ * Output is committed one line at a time: a line only becomes available
+ * for draining once its '\n' has been written. If a line does not fit in
+ * the free space, the whole line is dropped (and counted), rather than
+ * stalling the caller or emitting a truncated line.
+ */
+template<size_t Size>
+class OutputRing : public Print {
+public: // initializers
+	OutputRing()
+		: head(0), committed(0), pending(0), dropping(false),
+		  num_written(0), num_dropped(0) { }
+
+public: // commands
+	using Print::write;
+
+	size_t write(uint8_t c)
+	{
+		if (!dropping && committed + pending == Size) {
+			dropping = true; // no room for the rest of this line
+			pending = 0;
+		}
+		if (dropping) {
+			if (c == '\n') {
+				dropping = false;
+				++num_dropped;
+			}
+			return 1;
+		}
+
+		buffer[(head + committed + pending) % Size] = c;
+		++pending;
+		if (c == '\n') {
+			committed += pending;
+			num_written += pending;
+			pending = 0;
+		}
+		return 1;
+	}
+
+	/*
+	 * Write up to room bytes of committed output to the given Print,
+	 * in at most two chunks. Return the number of bytes written.
+	 */
+	size_t drain(Print & out, size_t room)
+	{
+		size_t total = 0;
+		while (committed && room) {
+			size_t len = MIN(MIN(committed, Size - head), room);
+			len = out.write((const uint8_t *) buffer + head, len);
+			if (!len)
+				break;
+			head = (head + len) % Size;
+			committed -= len;
+			room -= len;
+			total += len;
+		}
+		return total;
+	}
+
+public: // queries
+	// Return the number of bytes waiting to be drained.
+	size_t available() const { return committed; }
+
+	// Return the number of lines dropped for lack of space.
+	unsigned long dropped() const { return num_dropped; }
+
+	void print_stats(Print & out) const
+	{
+		out.print(F("<OutputRing, size = "));
+		out.print(Size);
+		out.print(F(", written = "));
+		out.print(num_written);
+		out.print(F(", dropped lines = "));
+		out.print(num_dropped);
+		out.println(F(">"));
+	}
+
+private: // representation
+	char buffer[Size];
+	size_t head; // start of committed output
+	size_t committed; // # of bytes ready to be drained
+	size_t pending; // # of bytes in the current (incomplete) line
+	bool dropping; // discarding the rest of the current line
+
+	unsigned long num_written;
+	unsigned long num_dropped;
+};
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef NEXA_NODE_PACKED_COMMAND_H
+#define NEXA_NODE_PACKED_COMMAND_H
+
+#include <stdint.h>
+
+/*
+ * Compact value representation of a Nexa command, packed into 32 bits.
+ *
+ * The layout mirrors the on-air 32-bit command format (D{24}10GSCCCC),
+ * with the version folded into the two constant bits:
+ *
+ *     DDDDDDDDDDDDDDDDDDDDDDDDVVGSCCCC
+ *
+ *  - D = 24-bit device id (MSB first, unlike on air)
+ *  - V = version (NexaCommand::Version); NEXA_32BIT is "10", as on air,
+ *        and NEXA_12BIT is "01"
+ *  - G = group bit
+ *  - S = state bit
+ *  - C = 4-bit channel
+ *
+ * A packed command is a plain 4-byte value: it can be copied, compared
+ * and hashed with single integer operations, which makes it a cheap key
+ * for caches and tables. All conversions are constexpr, so constant
+ * commands can be built (and checked) at compile time.
+ *
+ * See NexaCommand::pack() and NexaCommand::from_packed() for converting
+ * to/from the full NexaCommand representation.
+ */
+class PackedCommand {
+public: // types & constants
+	static const unsigned device_shift = 8;
+	static const unsigned version_shift = 6;
+	static const uint32_t group_bit = 1UL << 5;
+	static const uint32_t state_bit = 1UL << 4;
+	static const uint32_t channel_mask = 0xf;
+
+public: // initializers
+	// The all-zero (invalid) command.
+	constexpr PackedCommand() : bits(0) { }
+
+	// Wrap the given packed bits.
+	explicit constexpr PackedCommand(uint32_t bits) : bits(bits) { }
+
+	// Pack the given fields; version is a NexaCommand::Version.
+	static constexpr PackedCommand make(unsigned version,
+		uint32_t device_id, bool group, unsigned channel, bool state)
+	{
+		return PackedCommand((device_id & 0xffffff) << device_shift |
+				     (version & 3) << version_shift |
+				     (group ? group_bit : 0) |
+				     (state ? state_bit : 0) |
+				     (channel & channel_mask));
+	}
+
+	/*
+	 * Unpack the bits of a 32-bit frame (DDDDDDDDDDDDDDDDDDDDDDDD10GSCCCC
+	 * in on-air order, i.e. the first bit received is the MSB).
+	 *
+	 * The constant "10" bits become the version, so a frame where they
+	 * are not "10" yields an invalid command.
+	 */
+	static constexpr PackedCommand from_32bit_frame(uint32_t frame)
+	{
+		return PackedCommand(reverse24(frame >> 8) << device_shift |
+				     (frame & 0xff));
+	}
+
+	/*
+	 * Unpack the bits of a 12-bit frame (DDDDDDDD011S in on-air order,
+	 * i.e. the first bit received is bit 11).
+	 *
+	 * A frame where the constant bits are not "011" yields an invalid
+	 * command.
+	 */
+	static constexpr PackedCommand from_12bit_frame(uint16_t frame)
+	{
+		return (frame >> 1 & 0b111) == 0b011
+			? make(1, reverse8(frame >> 4), false, 0, frame & 1)
+			: PackedCommand();
+	}
+
+public: // queries
+	constexpr uint32_t value() const { return bits; }
+
+	constexpr unsigned version() const { return bits >> version_shift & 3; }
+	constexpr uint32_t device_id() const { return bits >> device_shift; }
+	constexpr bool group() const { return bits & group_bit; }
+	constexpr bool state() const { return bits & state_bit; }
+	constexpr unsigned channel() const { return bits & channel_mask; }
+
+	// Return true iff this has a valid version (NEXA_12BIT/NEXA_32BIT).
+	constexpr bool valid() const
+	{
+		return version() == 1 || version() == 2;
+	}
+
+	/*
+	 * Return the (version, device id) part of this command as a single
+	 * integer, identifying the sending/receiving device. Keys sort by
+	 * device id first.
+	 */
+	constexpr uint32_t device_key() const { return bits >> version_shift; }
+
+	// Return the bits of the 32-bit frame encoding this command.
+	constexpr uint32_t to_32bit_frame() const
+	{
+		return reverse24(device_id()) << 8 | 0b10 << version_shift |
+		       (bits & (group_bit | state_bit | channel_mask));
+	}
+
+	// Return the bits of the 12-bit frame encoding this command.
+	constexpr uint16_t to_12bit_frame() const
+	{
+		return reverse8(device_id()) << 4 | 0b011 << 1 |
+		       (state() ? 1 : 0);
+	}
+
+	/*
+	 * Return a Fibonacci hash of this command. The upper bits of the
+	 * hash are the best mixed; use hash(n) to get an n-bit (n = 1..31)
+	 * bucket index for a table of 2^n buckets.
+	 */
+	constexpr uint32_t hash() const { return bits * 2654435769UL; }
+	constexpr uint32_t hash(unsigned n) const { return hash() >> (32 - n); }
+
+	constexpr bool operator==(const PackedCommand & other) const
+	{
+		return bits == other.bits;
+	}
+	constexpr bool operator!=(const PackedCommand & other) const
+	{
+		return bits != other.bits;
+	}
+
+private: // helpers
+	// Swap the bit groups selected by mask with those shift bits above.
+	static constexpr uint32_t swap(uint32_t x, uint32_t mask,
+				       unsigned shift)
+	{
+		return (x >> shift & mask) | (x & mask) << shift;
+	}
+
+	static constexpr uint32_t reverse32(uint32_t x)
+	{
+		return swap(swap(swap(swap(swap(x,
+			0x55555555, 1), 0x33333333, 2), 0x0f0f0f0f, 4),
+			0x00ff00ff, 8), 0x0000ffff, 16);
+	}
+
+	// Reverse the lower 24/8 bits of x
+	static constexpr uint32_t reverse24(uint32_t x)
+	{
+		return reverse32(x) >> 8;
+	}
+	static constexpr uint32_t reverse8(uint32_t x)
+	{
+		return reverse32(x) >> 24;
+	}
+
+private: // representation
+	uint32_t bits;
+};
+
+static_assert(sizeof(PackedCommand) == 4, "PackedCommand must be 4 bytes");
+static_assert(PackedCommand::from_32bit_frame(
+	PackedCommand::make(2, 0xd38eb8, false, 2, true).to_32bit_frame()) ==
+	PackedCommand::make(2, 0xd38eb8, false, 2, true),
+	"32-bit frame conversion must round-trip");
+static_assert(PackedCommand::from_12bit_frame(
+	PackedCommand::make(1, 0x5a, false, 0, true).to_12bit_frame()) ==
+	PackedCommand::make(1, 0x5a, false, 0, true),
+	"12-bit frame conversion must round-trip");
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef NEXA_NODE_PULSE_FILTER_H
+#define NEXA_NODE_PULSE_FILTER_H
+
+#include "Macros.h"
+#include "PulseParser.h"
+
+#include <limits.h>
+
+/*
+ * Pre-filter incoming pulses before they reach the PulseParser.
+ *
+ * In a noisy band, the RX module produces lots of very short glitch
+ * pulses, each of which would otherwise reset the PulseParser state
+ * machine in the middle of a frame. This filter sits between
+ * RF433Transceiver::rx_get_pulse() and the PulseParser, and:
+ *
+ *  - absorbs glitches (pulses shorter than min_width µs) into the
+ *    surrounding pulses: the glitch and the following pulse of the same
+ *    sign as the preceding pulse are merged into the preceding pulse.
+ *    If the glitches of the opposite sign add up to at least min_width
+ *    µs, they are a short pulse that interference cut into pieces, and
+ *    are passed on as one pulse of that sign instead.
+ *
+ *  - gates noise while the parser is idle: pulses that cannot start a
+ *    Nexa command (see PulseParser::starts_frame()) are dropped without
+ *    running the parser, since they would leave it idle anyway. Most
+ *    pulses in a noisy band end up here, so a pulse that follows no
+ *    glitches goes straight to the gate, without merge bookkeeping.
+ *
+ * Since a pulse may have to be merged with the pulses that follow it,
+ * each pulse is held back until the next non-glitch pulse arrives. As
+ * that would delay the last pulse of a frame until the band's next
+ * edge, the owner should also call flush() while waiting for pulses:
+ * once the pulse in progress is longer than a glitch, nothing can be
+ * merged into the held pulse any more, and it is passed on at once.
+ *
+ * The number of pulses removed by each stage is counted.
+ */
+class PulseFilter {
+public: // initializers
+	PulseFilter(PulseParser & parser, int min_width = 100)
+		: parser(parser), min_width(min_width), pending(0),
+		  pending_fine(0), merging(false), run_len(0), run_other(0),
+		  run_fine(0), num_in(0), num_absorbed(0), num_gated(0),
+		  num_passed(0) { }
+
+public: // commands
+	/**
+	 * Filter the given pulse (as produced by rx_get_pulse()), and pass
+	 * on the result to the parser. Return whether the parser is
+	 * currently busy() or not.
+	 *
+	 * The optional fine length of the pulse (1/16 µs) is merged along
+	 * with the pulse, and passed on to the parser's timing measurements
+	 * (see PulseParser::operator()).
+	 */
+	bool operator()(int pulse, unsigned long fine = 0);
+
+	/**
+	 * Pass on the held pulse, if the pulse that follows it (which is
+	 * still in progress) has lasted for at least min_width µs. Return
+	 * whether the parser is busy().
+	 */
+	bool flush(unsigned long in_progress);
+
+public: // queries
+	bool busy() const { return parser.busy(); }
+
+	// Return the length (µs) of the pulse held back (0 if none).
+	unsigned long held() const { return abs(pending) + run_len; }
+
+	unsigned long pulses_in() const { return num_in; }
+	unsigned long glitches_absorbed() const { return num_absorbed; }
+	unsigned long pulses_gated() const { return num_gated; }
+	unsigned long pulses_passed() const { return num_passed; }
+
+	void print(Print & out) const
+	{
+		out.print(F("<PulseFilter, in = "));
+		out.print(num_in);
+		out.print(F(", absorbed = "));
+		out.print(num_absorbed);
+		out.print(F(", gated = "));
+		out.print(num_gated);
+		out.print(F(", passed = "));
+		out.print(num_passed);
+		out.println(F(">"));
+	}
+
+private: // helpers
+	void end_run()
+	{
+		merging = false;
+		run_len = run_other = run_fine = 0;
+	}
+
+	// Pass the given pulse to the parser, unless the noise gate is shut.
+	void emit(int pulse, unsigned long fine)
+	{
+		if (!parser.busy() && !PulseParser::starts_frame(pulse)) {
+			++num_gated;
+			return;
+		}
+		++num_passed;
+		parser(pulse, fine);
+	}
+
+	// Extend the pending pulse by the given length (µs) and fine length.
+	void extend(unsigned long length, unsigned long fine)
+	{
+		if (!pending_fine)
+			pending_fine = (unsigned long) abs(pending) << 4;
+		pending_fine += fine;
+		int len = MIN(length, (unsigned long) INT_MAX);
+		if (pending < 0)
+			pending = (pending < -INT_MAX + len) ? -INT_MAX : pending - len;
+		else
+			pending = (pending > INT_MAX - len) ? INT_MAX : pending + len;
+	}
+
+private: // representation
+	PulseParser & parser;
+	const int min_width; // pulses shorter than this are glitches (µs)
+	int pending; // pulse held back for merging (0 == none)
+	unsigned long pending_fine; // of pending (1/16 µs, 0 == unknown)
+	bool merging; // glitches follow the pending pulse (see run_len)
+
+	// Glitches since the pending pulse, not yet merged into it
+	unsigned long run_len; // total length (µs)
+	unsigned long run_other; // length of those of the opposite sign (µs)
+	unsigned long run_fine; // total fine length (1/16 µs)
+
+	unsigned long num_in;
+	unsigned long num_absorbed;
+	unsigned long num_gated;
+	unsigned long num_passed;
+};
+
+bool PulseFilter::operator()(int pulse, unsigned long fine)
+{
+	++num_in;
+	bool glitch = abs(pulse) < min_width;
+	if (!glitch && !merging) {
+		// Common case: the pending pulse is complete; its fine
+		// length is left to the parser, if it gets past the gate
+		if (pending)
+			emit(pending, pending_fine);
+		pending = pulse;
+		pending_fine = fine;
+		return parser.busy();
+	}
+
+	if (!fine)
+		fine = (unsigned long) abs(pulse) << 4;
+	if (glitch) {
+		++num_absorbed;
+		if (pending) {
+			run_len += abs(pulse);
+			run_fine += fine;
+			if ((pulse > 0) != (pending > 0))
+				run_other += abs(pulse);
+			merging = true;
+		}
+		return parser.busy();
+	}
+
+	if (merging) {
+		bool same = (pulse > 0) == (pending > 0);
+		if (same && run_other < (unsigned long) min_width) {
+			// pulse continues the pending pulse after glitches
+			extend(run_len, run_fine);
+			extend(abs(pulse), fine);
+			end_run();
+			return parser.busy();
+		}
+		if (same) { // the glitches are a pulse that was cut up
+			emit(pending, pending_fine);
+			int len = MIN(run_len, (unsigned long) INT_MAX);
+			pending = pending > 0 ? -len : len;
+			pending_fine = run_fine;
+		}
+		else // the glitches end the pending pulse
+			extend(run_len, run_fine);
+		end_run();
+	}
+
+	if (pending)
+		emit(pending, pending_fine);
+	pending = pulse;
+	pending_fine = fine;
+	return parser.busy();
+}
+
+bool PulseFilter::flush(unsigned long in_progress)
+{
+	if (pending && !merging && in_progress >= (unsigned long) min_width) {
+		emit(pending, pending_fine);
+		pending = 0;
+	}
+	return parser.busy();
+}
+
+#endif
@@ -3,8 +3,33 @@
 
 #include "RingBuffer.h"
 
+#include <stdint.h>
+#include <string.h>
+
 //include <Arduino.h>
 
+/*
+ * Timing measurements of the pulses in a single received frame.
+ *
+ * The pulses that exist in both Nexa command formats are measured: the
+ * SYNC pulse, the SHORT HIGH pulses, and the LONG LOW pulses. For the
+ * SHORT and LONG pulses, the count, sum and sum of squares are kept, so
+ * that mean and variance can be derived, and merged across frames.
+ *
+ * Lengths are given in 1/16 µs units, so that the sub-µs resolution of
+ * high-resolution capture timestamps (see CycleClock) is retained.
+ */
+struct FrameTiming {
+	enum PulseClass { SHORT_HIGH, LONG_LOW, NUM_CLASSES };
+
+	bool complete; // false if the frame was aborted after SYNC
+	byte bits; // # of data bits received
+	unsigned long sync; // length of SYNC pulse (1/16 µs)
+	unsigned short n[NUM_CLASSES];
+	unsigned long sum[NUM_CLASSES]; // 1/16 µs
+	uint64_t sumsq[NUM_CLASSES]; // (1/16 µs)^2
+};
+
 /*
  * Process incoming pulses from the RX module, and generate bit sequences.
  *
@@ -19,17 +44,34 @@
  *
  * The generated strings are pushed onto a RingBuffer, enabling the parser
  * to be run from an ISR.
+ *
+ * Optionally, the timing of each frame is measured, and a FrameTiming
+ * record is pushed onto a second RingBuffer whenever a frame is completed
+ * or aborted after its SYNC. Completed frames correspond 1:1 (and in
+ * order) with the commands decoded by NexaCommand::from_bit_buffer().
+ *
+ * Neither ring buffer may overflow, or that correspondence would be
+ * lost (and overflowing a RingBuffer discards its whole contents). A
+ * frame is therefore only started if both buffers have room for all of
+ * it; otherwise the whole frame is dropped, and counted (see dropped()).
  */
 class PulseParser {
 public:
-	PulseParser(RingBuffer<char> & buffer)
-		: buffer(buffer), cur_state(UNKNOWN), cur_bit(0) { }
+	PulseParser(RingBuffer<char> & buffer,
+		    RingBuffer<FrameTiming> * timings = NULL)
+		: buffer(buffer), timings(timings), cur_state(UNKNOWN),
+		  cur_bit(0), in_frame(false), expect_bits(0), last_sync(0),
+		  num_dropped(0) { }
 
 	/**
 	 * Drive state machine with pulses from Nexa RF waveform. Return
 	 * whether we're currently busy() or not.
+	 *
+	 * The optional fine length of the pulse (in 1/16 µs units) is
+	 * used for timing measurements only. If not given, it is derived
+	 * from the pulse itself.
 	 */
-	bool operator()(int pulse);
+	bool operator()(int pulse, unsigned long fine = 0);
 
 	/**
 	 * Return true if the current state indicates that we're in the
@@ -40,18 +82,62 @@ public:
 	 */
 	bool busy() const { return cur_state != UNKNOWN; }
 
+	/**
+	 * Return true iff the given pulse may start a new Nexa command,
+	 * i.e. whether it would move an idle parser out of the UNKNOWN
+	 * state. While the parser is not busy(), any other pulse can be
+	 * discarded without changing the outcome.
+	 *
+	 * This is called for every pulse while idle, so instead of a full
+	 * quantize_pulse(), it tests the same bits directly: a LOW pulse
+	 * whose length (mod 65536) is in category 5, 8192µs - 16383µs.
+	 */
+	static bool starts_frame(int pulse)
+	{
+		return pulse < 0 && (-pulse & 0xe000) == 0x2000;
+	}
+
+	/// Return the number of frames dropped, since a buffer was full.
+	unsigned long dropped() const { return num_dropped; }
+
+	void print(Print & out) const
+	{
+		out.print(F("<PulseParser, dropped frames = "));
+		out.print(num_dropped);
+		out.println(F(">"));
+	}
+
 private: // helpers
 	/// classify pulses by length into category 1..5
 	static int quantize_pulse(int p);
 
+	/// start new frame ('A' or 'B'), after SYNC has been detected
+	void begin_frame(char sync);
+
+	/// push data bit belonging to the current frame
+	void push_bit(char bit);
+
+	/// record timing of pulse (of category p, given fine length) in frame
+	void measure(int p, unsigned long fine);
+
+	/// emit timing record for the current frame
+	void end_frame(bool complete);
+
 private: // representation
 	RingBuffer<char> & buffer;
+	RingBuffer<FrameTiming> * timings;
 	enum State {
 		UNKNOWN, SX1, SX2, SX3,
 		DA0, DA1, DA2, DA3,
 		DB0, DB1, DB2, DB3,
 	} cur_state;
 	byte cur_bit;
+
+	bool in_frame; // SYNC seen, but not all data bits
+	byte expect_bits;
+	unsigned long last_sync; // 1/16 µs
+	FrameTiming cur_frame;
+	unsigned long num_dropped;
 };
 
 /*
@@ -105,15 +191,20 @@ int PulseParser::quantize_pulse(int p)
  * command is currently being received. Otherwise, return false if we're
  * "busy" receiving what might end up being a valid command.
  */
-bool PulseParser::operator()(int pulse)
+bool PulseParser::operator()(int pulse, unsigned long fine)
 {
 	State new_state = UNKNOWN;
     //Serial.println("a");
 	int p = quantize_pulse(pulse); // current pulse
     //Serial.println("b");
+	if (!fine)
+		fine = (unsigned long) abs(pulse) << 4;
+	if (in_frame)
+		measure(p, fine);
 	switch (p) {
 		case -5: // LOW: 8192µs <= pulse < 16384µs => SYNC start
 			new_state = SX1;
+			last_sync = fine;
 			break;
 		case -3: // LOW: 2048µs <= pulse < 4096µs
 			if (cur_state == SX2) // cmd format A
@@ -128,11 +219,11 @@ bool PulseParser::operator()(int pulse)
 				new_state = DA3;
 			else if (cur_state == SX2 || cur_state == DB1) {
 				if (cur_state == SX2) // cmd format B
-					buffer.w_push('B');
+					begin_frame('B');
 				new_state = DB2;
 			}
 			else if (cur_state == DB3 && cur_bit == '0') {
-				buffer.w_push(cur_bit);
+				push_bit(cur_bit);
 				cur_bit = 0;
 				new_state = DB0;
 			}
@@ -145,7 +236,7 @@ bool PulseParser::operator()(int pulse)
 			else if (cur_state == DA2 && cur_bit == '1')
 				new_state = DA3;
 			else if (cur_state == DB3 && cur_bit == '1') {
-				buffer.w_push(cur_bit);
+				push_bit(cur_bit);
 				cur_bit = 0;
 				new_state = DB0;
 			}
@@ -162,14 +253,14 @@ bool PulseParser::operator()(int pulse)
 					new_state = SX2;
 					break;
 				case SX3:
-					buffer.w_push('A');
+					begin_frame('A');
 					new_state = DA0;
 					break;
 				case DA1:
 					new_state = DA2;
 					break;
 				case DA3:
-					buffer.w_push(cur_bit);
+					push_bit(cur_bit);
 					cur_bit = 0;
 					new_state = DA0;
 					break;
@@ -183,8 +274,58 @@ bool PulseParser::operator()(int pulse)
 			}
 			break;
 	}
+	if (in_frame && (new_state == UNKNOWN || new_state == SX1))
+		end_frame(false); // frame aborted
 	cur_state = new_state;
 	return busy();
 }
 
+void PulseParser::begin_frame(char sync)
+{
+	if (in_frame)
+		end_frame(false);
+	expect_bits = sync == 'A' ? 32 : 12;
+	if (buffer.w_available() < 1 + (size_t) expect_bits ||
+	    (timings && !timings->w_available())) {
+		++num_dropped; // ignore the bits of this frame
+		return;
+	}
+	buffer.w_push(sync);
+	in_frame = true;
+	memset(&cur_frame, 0, sizeof(cur_frame));
+	cur_frame.sync = last_sync;
+}
+
+void PulseParser::push_bit(char bit)
+{
+	if (!in_frame)
+		return; // frame complete, or dropped
+	buffer.w_push(bit);
+	if (++cur_frame.bits == expect_bits)
+		end_frame(true);
+}
+
+void PulseParser::measure(int p, unsigned long fine)
+{
+	int c;
+	if (p == 1)
+		c = FrameTiming::SHORT_HIGH;
+	else if (p == -2)
+		c = FrameTiming::LONG_LOW;
+	else
+		return;
+	cur_frame.n[c]++;
+	cur_frame.sum[c] += fine;
+	cur_frame.sumsq[c] += (uint64_t) fine * fine;
+}
+
+void PulseParser::end_frame(bool complete)
+{
+	in_frame = false;
+	if (!timings)
+		return;
+	cur_frame.complete = complete;
+	timings->w_push(cur_frame);
+}
+
 #endif
@@ -0,0 +1,106 @@
+#ifndef NEXA_NODE_PULSE_SCHEDULE_H
+#define NEXA_NODE_PULSE_SCHEDULE_H
+
+#include "Macros.h"
+#include "RF433Transceiver.h"
+
+/*
+ * A pre-encoded sequence of HIGH/LOW pulses, ready for transmission.
+ *
+ * Pulses use the same representation as RF433Transceiver::rx_get_pulse():
+ * the absolute value is the pulse length in µs, and the sign is positive
+ * for a HIGH pulse and negative for a LOW pulse.
+ *
+ * A schedule consists of a frame, which is repeated for every repetition
+ * of the command, followed by an (optional) tail, which is transmitted
+ * once after the last repetition. The transmitter is always left LOW
+ * after the schedule has been played.
+ *
+ * Encoding a command into a schedule once, and then playing the schedule
+ * as many times as needed, avoids re-encoding the same bits over and
+ * over (see FrameCache).
+ */
+class PulseSchedule {
+public: // types & constants
+	// Enough for a 32-bit Nexa command (4 SYNC + 32 * 4 data pulses)
+	static const size_t max_pulses = 136;
+
+public: // initializers
+	PulseSchedule() : frame_len(0), tail_len(0) { }
+
+	// Discard all pulses in this schedule.
+	void clear() { frame_len = tail_len = 0; }
+
+	/*
+	 * Append a pulse to the repeated frame part of this schedule.
+	 *
+	 * Must not be called after append_tail().
+	 */
+	void append(int pulse)
+	{
+		ASSERT(!tail_len);
+		ASSERT(frame_len < max_pulses);
+		pulses[frame_len++] = pulse;
+	}
+
+	// Append a pulse to the non-repeated tail of this schedule.
+	void append_tail(int pulse)
+	{
+		ASSERT(frame_len + tail_len < max_pulses);
+		pulses[frame_len + tail_len++] = pulse;
+	}
+
+public: // queries
+	// Return the number of pulses in the repeated frame part.
+	size_t frame_pulses() const { return frame_len; }
+
+	// Return the i-th pulse (i < frame_pulses()) of the frame part.
+	int frame_pulse(size_t i) const { return pulses[i]; }
+
+	/*
+	 * Return the total time (in µs) the transmitter is busy when
+	 * playing this schedule with the given number of repetitions.
+	 */
+	unsigned long airtime(size_t reps = 1) const
+	{
+		unsigned long frame = 0, tail = 0;
+		for (size_t i = 0; i < frame_len; ++i)
+			frame += abs(pulses[i]);
+		for (size_t i = frame_len; i < frame_len + tail_len; ++i)
+			tail += abs(pulses[i]);
+		return frame * reps + tail;
+	}
+
+	/*
+	 * Transmit the frame the given number of times, followed by the
+	 * tail, on the given RF transmitter.
+	 */
+	void play(RF433Transceiver & rf_port, size_t reps = 1) const
+	{
+		rf_port.tx_begin();
+		for (size_t r = 0; r < reps; ++r)
+			play_pulses(rf_port, 0, frame_len);
+		play_pulses(rf_port, frame_len, frame_len + tail_len);
+		rf_port.transmit(LOW);
+		rf_port.tx_end();
+	}
+
+private: // helpers
+	void play_pulses(RF433Transceiver & rf_port,
+			 size_t from, size_t to) const
+	{
+		for (size_t i = from; i < to; ++i) {
+			if (pulses[i] > 0)
+				rf_port.transmit(HIGH, pulses[i]);
+			else
+				rf_port.transmit(LOW, -pulses[i]);
+		}
+	}
+
+private: // representation
+	short pulses[max_pulses];
+	byte frame_len;
+	byte tail_len;
+};
+
+#endif
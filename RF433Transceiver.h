@@ -2,8 +2,10 @@
 #define NEXA_NODE_RF433_TRANSCEIVER_H
 
 #include "Macros.h"
+#include "CycleClock.h"
 #include "FastPort.h"
 #include "IO.h"
+#include "RingBuffer.h"
 
 #include <limits.h>
 
@@ -25,9 +27,11 @@
 class RF433Transceiver {
 public:
 	RF433Transceiver()
-		: pulse_start(0), pulse_state(false), io(IO())
+		: pulse_start(0), pulse_state(false), io(IO()),
+		  rx_pulses(NULL), rx_dropping(false), rx_gap_start(0),
+		  rx_num_dropped(0), tx_active(false)
 	{
-
+		CycleClock::begin();
 	}
 
 	/*
@@ -67,27 +71,150 @@ public:
 	 * This method must be called with high frequency, at least twice
 	 * as high as the frequency of the shortest pulse to be detected.
 	 *
-	 * This method assumes that the longest pulse of interest is <
-	 * INT_MAX µs. The length of the returned pulse is pinned to
-	 * INT_MAX/-INT_MAX (for a HIGH/LOW pulses, respectively).
+	 * Pulse edges are timestamped with the CPU cycle counter (see
+	 * CycleClock), so pulses longer than its wraparound period (~59s
+	 * at 72MHz) are measured modulo that period. This is harmless, as
+	 * such pulses are only ever seen between transmissions.
 	 */
 	int rx_get_pulse()
 	{
 		while (pulse_state == rx_pin())
 			; // spin until state changes
-		unsigned long now = micros();
+		CycleClock::ticks_t now = CycleClock::now();
 		bool ret_state = pulse_state;
 		pulse_state = rx_pin();
 
-		unsigned long elapsed = now - pulse_start;
+		unsigned long elapsed = CycleClock::to_us(
+			CycleClock::elapsed(pulse_start, now));
 		pulse_start = now;
 		return int(MIN(elapsed, INT_MAX)) * (ret_state ? 1 : -1);
 	}
 
+	/*
+	 * Capture RX pulses from a pin change interrupt.
+	 *
+	 * This is the non-blocking alternative to rx_get_pulse(): on every
+	 * change of rx_pin(), the pulse that just ended is pushed onto the
+	 * given ring buffer. The representation is as returned by
+	 * rx_get_pulse(), except that the pulse length is given in CPU
+	 * cycles (see CycleClock), pinned to INT_MAX cycles. Converting to
+	 * µs is left to the consumer, to keep the ISR short, and to retain
+	 * the full resolution for timing measurements.
+	 *
+	 * The caller should consume the ring buffer often enough to keep
+	 * it from filling up. While it is full, pulses are dropped (and
+	 * counted, see rx_dropped()). Once there is room again, the dropped
+	 * pulses are replaced by one HIGH pulse spanning them, so that the
+	 * time between the edges on either side of the gap is kept, and a
+	 * frame in progress is aborted (unless the gap is shorter than a
+	 * Nexa HIGH pulse) rather than spliced together with later pulses.
+	 *
+	 * Pulses are not captured while we are transmitting (between
+	 * tx_begin() and tx_end()), since the receiver will then only pick
+	 * up our own transmission.
+	 *
+	 * Only one transceiver instance can capture pulses at a time.
+	 */
+	void rx_begin_capture(RingBuffer<int> & pulses)
+	{
+		rx_pulses = &pulses;
+		rx_dropping = false;
+		rx_num_dropped = 0;
+		capturing = this;
+		pulse_state = rx_pin();
+		pulse_start = CycleClock::now();
+		attachInterrupt(RX_PIN, rx_isr, CHANGE);
+	}
+
+	// Return the time (CycleClock::now()) of the last RX pin change.
+	CycleClock::ticks_t rx_last_edge() const { return pulse_start; }
+
+	// Return the number of RX pulses dropped since capture started.
+	unsigned long rx_dropped() const { return rx_num_dropped; }
+
+	void print(Print & out) const
+	{
+		out.print(F("<RF433Transceiver, dropped RX pulses = "));
+		out.print(rx_num_dropped);
+		out.println(F(">"));
+	}
+
+	// Stop capturing RX pulses.
+	void rx_end_capture()
+	{
+		detachInterrupt(RX_PIN);
+		capturing = NULL;
+	}
+
+	// Suspend RX capture while transmitting.
+	void tx_begin() { tx_active = true; }
+
+	/*
+	 * Resume RX capture after transmitting. Interrupts are masked, so
+	 * that rx_edge() sees the new pulse_state and pulse_start together.
+	 */
+	void tx_end()
+	{
+		noInterrupts();
+		pulse_state = rx_pin();
+		pulse_start = CycleClock::now();
+		tx_active = false;
+		interrupts();
+	}
+
+private:
+	// Record the pulse that ended at this RX pin change.
+	void rx_edge()
+	{
+		CycleClock::ticks_t now = CycleClock::now();
+		bool ret_state = pulse_state;
+		pulse_state = rx_pin();
+
+		CycleClock::ticks_t start = pulse_start;
+		pulse_start = now;
+		if (tx_active)
+			return;
+
+		if (!rx_pulses->w_available()) {
+			if (!rx_dropping) {
+				rx_dropping = true;
+				rx_gap_start = start;
+			}
+			++rx_num_dropped;
+		}
+		else if (rx_dropping) {
+			CycleClock::ticks_t gap =
+				CycleClock::elapsed(rx_gap_start, now);
+			rx_pulses->w_push(int(MIN(gap, INT_MAX)));
+			rx_dropping = false;
+		}
+		else {
+			CycleClock::ticks_t elapsed =
+				CycleClock::elapsed(start, now);
+			rx_pulses->w_push(int(MIN(elapsed, INT_MAX)) *
+					  (ret_state ? 1 : -1));
+		}
+	}
+
+	static void rx_isr()
+	{
+		if (capturing)
+			capturing->rx_edge();
+	}
+
 private:
-	unsigned long pulse_start;
-	bool pulse_state;
+	volatile CycleClock::ticks_t pulse_start;
+	volatile bool pulse_state;
     IO io;
+	RingBuffer<int> * rx_pulses;
+	bool rx_dropping; // rx_pulses is full; pulses are being dropped
+	CycleClock::ticks_t rx_gap_start; // start of first dropped pulse
+	volatile unsigned long rx_num_dropped;
+	volatile bool tx_active;
+
+	static RF433Transceiver * volatile capturing;
 };
 
+RF433Transceiver * volatile RF433Transceiver::capturing = NULL;
+
 #endif
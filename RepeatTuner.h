@@ -0,0 +1,218 @@
+#ifndef NEXA_NODE_REPEAT_TUNER_H
+#define NEXA_NODE_REPEAT_TUNER_H
+
+#include "Macros.h"
+#include "NexaCommand.h"
+
+/*
+ * Adapt the number of repetitions of transmitted commands per device.
+ *
+ * Every transmitted command opens a confirmation window. If the same
+ * command (device id, state, and channel unless group) is received
+ * during the window - e.g. echoed by the device itself, by a paired
+ * remote, or by a repeater - the transmission is counted as confirmed.
+ * Failures are either reported explicitly (report_failure()), or
+ * inferred when a device that has confirmed transmissions before stays
+ * silent for a whole window. Devices that have never confirmed anything
+ * only learn from explicit failure reports.
+ *
+ * After a streak of successes, while the success rate is above target,
+ * the repeat count of a device is decreased by one. A failure raises the
+ * repeat count by two (up to max_reps).
+ *
+ * Per device, the success rate and the airtime saved relative to the
+ * default repeat count are tracked.
+ */
+class RepeatTuner {
+public: // types & constants
+	static const size_t max_devices = 16;
+	static const byte min_reps = 1;
+	static const byte max_reps = 8;
+
+	// Time to wait for a confirmation after transmitting (ms)
+	static const unsigned long confirm_window = 2000;
+
+	// Success rate (percent) that must be maintained
+	static const byte target_rate = 90;
+
+	// Successes in a row before trying one repetition less
+	static const byte streak_len = 3;
+
+public: // initializers
+	RepeatTuner(byte default_reps) : default_reps(default_reps),
+		num_devices(0) { }
+
+public: // commands
+	/*
+	 * Return the number of repetitions to use when transmitting the
+	 * given command.
+	 */
+	byte reps_for(const NexaCommand & cmd) const
+	{
+		int i = index_of(cmd.pack());
+		return i == -1 ? default_reps : devices[i].reps;
+	}
+
+	/*
+	 * Account for the given command, which was just transmitted at the
+	 * given time (ms) with the given repetitions, each taking the given
+	 * airtime (µs).
+	 */
+	void on_transmit(const NexaCommand & cmd, byte reps,
+			 unsigned long frame_airtime, unsigned long now);
+
+	// Account for a command received at the given time (ms).
+	void on_receive(const NexaCommand & cmd, unsigned long now);
+
+	// Report that the given transmitted command did not take effect.
+	void report_failure(const NexaCommand & cmd);
+
+	// Close confirmation windows that have expired at the given time.
+	void tick(unsigned long now);
+
+public: // queries
+	// Print the given range of devices (by default, all of them).
+	void print(Print & out, size_t first = 0,
+		   size_t count = max_devices) const;
+
+private: // helpers
+	struct Device {
+		byte reps;
+		byte streak; // successes in a row
+		bool confirms; // has confirmed a transmission before
+		bool waiting; // confirmation window open
+		PackedCommand last_cmd; // last transmitted command (never 0)
+		unsigned long last_tx; // time of last transmission
+		unsigned long sent;
+		unsigned long succeeded;
+		unsigned long failed;
+		long saved_us; // airtime saved vs. default_reps
+	};
+
+	int index_of(PackedCommand cmd) const
+	{
+		uint32_t key = cmd.device_key();
+		for (size_t i = 0; i < num_devices; ++i) {
+			if (devices[i].last_cmd.device_key() == key)
+				return i;
+		}
+		return -1;
+	}
+
+	// Return true iff the given received command confirms sent.
+	static bool confirms(PackedCommand sent, PackedCommand rcvd)
+	{
+		return sent.state() == rcvd.state() &&
+		       (sent.group() || rcvd.group() ||
+			sent.channel() == rcvd.channel());
+	}
+
+	unsigned int rate(const Device & d) const
+	{
+		unsigned long total = d.succeeded + d.failed;
+		return total ? d.succeeded * 100 / total : 100;
+	}
+
+	void success(Device & d);
+	void failure(Device & d);
+
+private: // representation
+	const byte default_reps;
+	Device devices[max_devices];
+	size_t num_devices;
+};
+
+void RepeatTuner::on_transmit(const NexaCommand & cmd, byte reps,
+			      unsigned long frame_airtime, unsigned long now)
+{
+	PackedCommand packed = cmd.pack();
+	int i = index_of(packed);
+	if (i == -1) {
+		if (num_devices == max_devices)
+			return;
+		i = num_devices++;
+		devices[i] = Device(); // zero-initialized
+		devices[i].reps = default_reps;
+	}
+	Device & d = devices[i];
+	d.waiting = true;
+	d.last_cmd = packed;
+	d.last_tx = now;
+	d.sent++;
+	d.saved_us += ((long) default_reps - reps) * (long) frame_airtime;
+}
+
+void RepeatTuner::on_receive(const NexaCommand & cmd, unsigned long now)
+{
+	PackedCommand packed = cmd.pack();
+	int i = index_of(packed);
+	if (i == -1)
+		return;
+	Device & d = devices[i];
+	if (!d.waiting || now - d.last_tx > confirm_window ||
+	    !confirms(d.last_cmd, packed))
+		return;
+	d.waiting = false;
+	d.confirms = true;
+	success(d);
+}
+
+void RepeatTuner::report_failure(const NexaCommand & cmd)
+{
+	int i = index_of(cmd.pack());
+	if (i == -1)
+		return;
+	devices[i].waiting = false;
+	failure(devices[i]);
+}
+
+void RepeatTuner::tick(unsigned long now)
+{
+	for (size_t i = 0; i < num_devices; ++i) {
+		Device & d = devices[i];
+		if (!d.waiting || now - d.last_tx <= confirm_window)
+			continue;
+		d.waiting = false;
+		if (d.confirms) // silence from a device that usually confirms
+			failure(d);
+	}
+}
+
+void RepeatTuner::print(Print & out, size_t first, size_t count) const
+{
+	for (size_t i = first; i < num_devices && i - first < count; ++i) {
+		const Device & d = devices[i];
+		out.print(F("REPS "));
+		out.print(d.last_cmd.version(), HEX);
+		out.print(':');
+		out.print(d.last_cmd.device_id(), HEX);
+		out.print(F(": reps = "));
+		out.print(d.reps);
+		out.print(F(", sent = "));
+		out.print(d.sent);
+		out.print(F(", success = "));
+		out.print(rate(d));
+		out.print(F("%, airtime saved = "));
+		out.print(d.saved_us / 1000);
+		out.println(F(" ms"));
+	}
+}
+
+void RepeatTuner::success(Device & d)
+{
+	d.succeeded++;
+	if (++d.streak < streak_len)
+		return;
+	d.streak = 0;
+	if (d.reps > min_reps && rate(d) >= target_rate)
+		d.reps--;
+}
+
+void RepeatTuner::failure(Device & d)
+{
+	d.failed++;
+	d.streak = 0;
+	d.reps = MIN(d.reps + 2, max_reps);
+}
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef NEXA_NODE_REPEATER_H
+#define NEXA_NODE_REPEATER_H
+
+#include "Macros.h"
+#include "NexaCommand.h"
+
+/*
+ * Range extender: re-transmit commands received from selected devices.
+ *
+ * Commands received from whitelisted devices are held until the
+ * original burst has ended (no repetition received for holdoff ms), and
+ * are then handed out by poll(), to be transmitted with the repeat count
+ * configured for the device.
+ *
+ * Every repeated command is remembered in a small cache of seen frames
+ * for seen_ttl ms. Commands found in this cache are not repeated again,
+ * which prevents loops between repeaters (and repeating the tail end of
+ * the original burst).
+ *
+ * Devices are identified by version and device id together, as the
+ * device key of their packed commands (see PackedCommand::device_key()),
+ * since 12-bit and 32-bit devices may have the same id.
+ */
+class Repeater {
+public: // types & constants
+	static const size_t max_devices = 8;
+	static const size_t max_pending = 4;
+	static const size_t seen_slots = 8;
+
+	// Time without repetitions before the original burst has ended (ms)
+	static const unsigned long holdoff = 100;
+
+	// Time a repeated command is remembered (ms)
+	static const unsigned long seen_ttl = 3000;
+
+public: // initializers
+	Repeater()
+		: num_devices(0), num_pending(0), seen_pos(0), repeat_count(0),
+		  suppress_count(0)
+	{
+		for (size_t i = 0; i < seen_slots; ++i)
+			seen[i].valid = false;
+	}
+
+public: // commands
+	/*
+	 * Repeat commands from the given device (key) with the given number
+	 * of repetitions. Zero repetitions removes the device from the
+	 * whitelist.
+	 *
+	 * Return false if the whitelist is full.
+	 */
+	bool set_device(uint32_t key, byte reps);
+
+	// Account for a command that was received at the given time (ms).
+	void on_command(const NexaCommand & cmd, unsigned long now);
+
+	/*
+	 * Retrieve the next command to be repeated at the given time (ms),
+	 * along with its repeat count.
+	 *
+	 * Return false if there is nothing to repeat at this time.
+	 */
+	bool poll(NexaCommand & cmd, byte & reps, unsigned long now);
+
+public: // queries
+	unsigned long repeated() const { return repeat_count; }
+	unsigned long suppressed() const { return suppress_count; }
+
+	void print(Print & out) const
+	{
+		out.print(F("<Repeater, devices = "));
+		out.print(num_devices);
+		out.print(F(", repeated = "));
+		out.print(repeat_count);
+		out.print(F(", suppressed = "));
+		out.print(suppress_count);
+		out.println(F(">"));
+	}
+
+private: // helpers
+	int device_index(uint32_t key) const
+	{
+		for (size_t i = 0; i < num_devices; ++i) {
+			if (devices[i].key == key)
+				return i;
+		}
+		return -1;
+	}
+
+	bool recently_seen(PackedCommand cmd, unsigned long now) const
+	{
+		for (size_t i = 0; i < seen_slots; ++i) {
+			if (seen[i].valid && seen[i].cmd == cmd &&
+			    now - seen[i].time < seen_ttl)
+				return true;
+		}
+		return false;
+	}
+
+private: // representation
+	struct Device {
+		uint32_t key; // PackedCommand::device_key()
+		byte reps;
+	} devices[max_devices];
+	size_t num_devices;
+
+	struct Pending {
+		PackedCommand cmd;
+		byte reps;
+		unsigned long last; // time of last repetition received
+	} pending[max_pending];
+	size_t num_pending;
+
+	struct Seen {
+		bool valid;
+		PackedCommand cmd;
+		unsigned long time;
+	} seen[seen_slots]; // ring buffer, oldest entry is overwritten
+	size_t seen_pos;
+
+	unsigned long repeat_count;
+	unsigned long suppress_count;
+};
+
+bool Repeater::set_device(uint32_t key, byte reps)
+{
+	int i = device_index(key);
+	if (i == -1) {
+		if (!reps)
+			return true;
+		if (num_devices == max_devices)
+			return false;
+		i = num_devices++;
+		devices[i].key = key;
+	}
+	else if (!reps) {
+		devices[i] = devices[--num_devices];
+		return true;
+	}
+	devices[i].reps = reps;
+	return true;
+}
+
+void Repeater::on_command(const NexaCommand & cmd, unsigned long now)
+{
+	PackedCommand packed = cmd.pack();
+	int d = device_index(packed.device_key());
+	if (d == -1)
+		return;
+	if (recently_seen(packed, now)) {
+		++suppress_count;
+		return;
+	}
+
+	for (size_t i = 0; i < num_pending; ++i) {
+		if (pending[i].cmd == packed) { // burst still in progress
+			pending[i].last = now;
+			return;
+		}
+	}
+	if (num_pending == max_pending) {
+		++suppress_count;
+		return;
+	}
+	Pending & p = pending[num_pending++];
+	p.cmd = packed;
+	p.reps = devices[d].reps;
+	p.last = now;
+}
+
+bool Repeater::poll(NexaCommand & cmd, byte & reps, unsigned long now)
+{
+	for (size_t i = 0; i < num_pending; ++i) {
+		if (now - pending[i].last < holdoff)
+			continue;
+
+		NexaCommand::from_packed(cmd, pending[i].cmd);
+		reps = pending[i].reps;
+
+		seen[seen_pos].valid = true;
+		seen[seen_pos].cmd = pending[i].cmd;
+		seen[seen_pos].time = now;
+		seen_pos = (seen_pos + 1) % seen_slots;
+		pending[i] = pending[--num_pending];
+		++repeat_count;
+		return true;
+	}
+	return false;
+}
+
+#endif
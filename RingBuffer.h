@@ -136,6 +136,13 @@ public: // read-side commands
 		r_pos = (r_pos + len) % size;
 	}
 
+public: // write-side queries
+	/**
+	 * Return the number of elements that can be pushed without
+	 * overwriting elements that have not been read yet.
+	 */
+	size_t w_available() const { return size - 1 - r_available(); }
+
 public: // write-side commands
 	/**
 	 * Push another element onto the ring buffer.
@@ -0,0 +1,427 @@
+#ifndef NEXA_NODE_RULE_TABLE_H
+#define NEXA_NODE_RULE_TABLE_H
+
+#include "Macros.h"
+#include "NexaCommand.h"
+
+#include <string.h>
+
+/*
+ * Local automation rules: received Nexa commands trigger transmissions.
+ *
+ * Each rule matches received commands on version and device id, and
+ * optionally on group bit, channel and state (any of which may be a
+ * wildcard). When a rule matches, its action (a Nexa command, or a named
+ * scene) is fired, either immediately or after the rule's delay. A rule
+ * will not fire again until its cooldown has expired; the cooldown is
+ * never shorter than repeat_window, so that the repetitions of a single
+ * received command only fire the rule once. A delayed action that does
+ * not fit among the max_pending waiting ones is dropped (and counted),
+ * and the rule may fire again on the next match.
+ *
+ * Rules are kept sorted on (version, device id) - the device key of the
+ * packed command (see PackedCommand::device_key()) - and matching rules
+ * are found with a binary search, instead of scanning all rules.
+ *
+ * Firing an action is left to the given callback, which also receives
+ * the origin time (µs) of the received command, so that the end-to-end
+ * latency of the rule can be measured (see record_latency()).
+ */
+class RuleTable {
+public: // types & constants
+	static const size_t max_rules = 16;
+	static const size_t max_pending = 8; // delayed actions
+	static const size_t max_scene_name = 8;
+	static const byte ANY = 0xff; // wildcard for group/channel/state
+	static const unsigned long max_ms = 0x7fffffff; // delay/cooldown
+	static const size_t saved_size = 24; // see save()
+
+	// Minimum time between two firings of the same rule (ms)
+	static const unsigned long repeat_window = 1000;
+
+	struct Action {
+		bool is_scene;
+		NexaCommand cmd; // if !is_scene
+		char scene[max_scene_name + 1]; // if is_scene
+	};
+
+	typedef void (*FireFunc)(const Action & action, unsigned long origin);
+
+public: // initializers
+	RuleTable(FireFunc fire)
+		: fire(fire), num_rules(0), num_pending(0), num_dropped(0),
+		  lat_count(0),
+		  lat_sum(0), lat_min(0), lat_max(0) { }
+
+public: // commands
+	/*
+	 * Add a rule from a string of the form "MATCH>ACTION[,DELAY[,COOL]]"
+	 * where:
+	 *  - MATCH is "V:DDDDDD:G:C:S" (see NexaCommand::from_cmd_str()),
+	 *    where G, C and S may be '*' to match any value
+	 *  - ACTION is either a command string "V:DDDDDD:G:C:S", or the
+	 *    name of a scene prefixed by '@'
+	 *  - DELAY is the time (ms) to wait before firing (default: 0)
+	 *  - COOL is the cooldown time (ms) of the rule (default: 0)
+	 * DELAY and COOL are decimal, and at most max_ms.
+	 *
+	 * An empty ACTION ("MATCH>") removes all rules with the given
+	 * MATCH.
+	 *
+	 * Return false if the string is invalid, or the table is full.
+	 */
+	bool define(const char * buf, size_t len);
+
+	/*
+	 * Add a rule saved by save().
+	 *
+	 * Return false if the saved rule is invalid, or the table is full.
+	 */
+	bool load(const byte * buf);
+
+	/*
+	 * Fire (or schedule) the actions of all rules matching the given
+	 * received command. The given time (ms) is used for delays and
+	 * cooldowns; the origin (µs) is passed on to the fire callback.
+	 *
+	 * Return the number of matching rules.
+	 */
+	size_t on_command(const NexaCommand & cmd, unsigned long now,
+			  unsigned long origin);
+
+	// Fire delayed actions that are due at the given time (ms).
+	void tick(unsigned long now);
+
+	// Record the end-to-end latency (µs) of a fired action.
+	void record_latency(unsigned long latency);
+
+public: // queries
+	size_t size() const { return num_rules; }
+
+	// Return the number of delayed actions dropped, as none could wait
+	unsigned long dropped() const { return num_dropped; }
+
+	/*
+	 * Save the i-th rule (i < size()) into buf, in a compact binary
+	 * form of saved_size bytes, e.g. for persistent storage:
+	 *
+	 *     KEY*4 G C S SCENE? ACTION*8 DELAY*4 COOL*4
+	 *
+	 * where ACTION is the packed command (see PackedCommand), or the
+	 * NUL-padded scene name. All integers are little-endian.
+	 */
+	void save(size_t i, byte * buf) const;
+
+	void print(Print & out) const;
+
+private: // helpers
+	struct Rule {
+		uint32_t key; // PackedCommand::device_key()
+		byte group; // or ANY
+		byte channel; // or ANY
+		byte state; // or ANY
+		Action action;
+		unsigned long delay;
+		unsigned long cooldown;
+		unsigned long last_fired;
+		bool fired;
+	};
+
+	// A copy of the action, so that rules may change while it waits
+	struct Pending {
+		Action action;
+		unsigned long due;
+		unsigned long origin;
+	};
+
+	// Return index of first rule whose key is >= the given key
+	size_t lower_bound(uint32_t key) const;
+
+	// Insert the given rule after the rules with an equal key
+	bool insert(Rule & rule);
+
+	static void put_u32(byte * p, uint32_t v)
+	{
+		for (size_t i = 0; i < 4; ++i)
+			p[i] = v >> (8 * i);
+	}
+	static uint32_t get_u32(const byte * p)
+	{
+		return p[0] | p[1] << 8 | (uint32_t) p[2] << 16 |
+		       (uint32_t) p[3] << 24;
+	}
+
+	// Parse the MATCH part of a rule; return false if invalid
+	static bool parse_match(Rule & rule, const char * buf, size_t len);
+
+	// Parse the ACTION part of a rule; return false if invalid
+	static bool parse_action(Action & action, const char * buf,
+				 size_t len);
+
+	// Parse a DELAY or COOL field; return false if invalid
+	static bool parse_ms(unsigned long & ms, const char * buf, size_t len);
+
+private: // representation
+	const FireFunc fire;
+	Rule rules[max_rules]; // sorted by key
+	size_t num_rules;
+	Pending pending[max_pending];
+	size_t num_pending;
+	unsigned long num_dropped; // delayed actions
+
+	unsigned long lat_count;
+	unsigned long lat_sum;
+	unsigned long lat_min;
+	unsigned long lat_max;
+};
+
+bool RuleTable::define(const char * buf, size_t len)
+{
+	const char * gt = (const char *) memchr(buf, '>', len);
+	if (!gt)
+		return false;
+
+	Rule rule;
+	if (!parse_match(rule, buf, gt - buf))
+		return false;
+
+	const char * p = gt + 1;
+	const char * end = buf + len;
+	if (p == end) { // remove rules with this match
+		size_t i = lower_bound(rule.key);
+		while (i < num_rules && rules[i].key == rule.key) {
+			if (rules[i].group == rule.group &&
+			    rules[i].channel == rule.channel &&
+			    rules[i].state == rule.state) {
+				memmove(rules + i, rules + i + 1,
+					(num_rules - i - 1) * sizeof(Rule));
+				--num_rules;
+			}
+			else
+				++i;
+		}
+		return true;
+	}
+
+	const char * comma = (const char *) memchr(p, ',', end - p);
+	if (!parse_action(rule.action, p, (comma ? comma : end) - p))
+		return false;
+	rule.delay = rule.cooldown = 0;
+	if (comma) {
+		p = comma + 1;
+		comma = (const char *) memchr(p, ',', end - p);
+		if (!parse_ms(rule.delay, p, (comma ? comma : end) - p))
+			return false;
+	}
+	if (comma && !parse_ms(rule.cooldown, comma + 1, end - comma - 1))
+		return false;
+	return insert(rule);
+}
+
+size_t RuleTable::on_command(const NexaCommand & cmd, unsigned long now,
+			     unsigned long origin)
+{
+	size_t matched = 0;
+	uint32_t key = cmd.pack().device_key();
+	for (size_t i = lower_bound(key);
+	     i < num_rules && rules[i].key == key; ++i) {
+		Rule & r = rules[i];
+		if ((r.group != ANY && r.group != cmd.group) ||
+		    (r.channel != ANY && r.channel != cmd.channel) ||
+		    (r.state != ANY && r.state != cmd.state))
+			continue;
+		++matched;
+
+		unsigned long cooldown = MAX(r.cooldown, repeat_window);
+		if (r.fired && now - r.last_fired < cooldown)
+			continue;
+		if (r.delay && num_pending == max_pending) {
+			++num_dropped;
+			continue;
+		}
+		r.fired = true;
+		r.last_fired = now;
+
+		if (!r.delay)
+			fire(r.action, origin);
+		else {
+			Pending & p = pending[num_pending++];
+			p.action = r.action;
+			p.due = now + r.delay;
+			p.origin = origin;
+		}
+	}
+	return matched;
+}
+
+void RuleTable::tick(unsigned long now)
+{
+	for (size_t i = 0; i < num_pending; ) {
+		if (long(now - pending[i].due) >= 0) {
+			fire(pending[i].action, pending[i].origin);
+			pending[i] = pending[--num_pending];
+		}
+		else
+			++i;
+	}
+}
+
+void RuleTable::record_latency(unsigned long latency)
+{
+	if (!lat_count || latency < lat_min)
+		lat_min = latency;
+	if (latency > lat_max)
+		lat_max = latency;
+	lat_sum += latency;
+	++lat_count;
+}
+
+void RuleTable::print(Print & out) const
+{
+	out.print(F("<RuleTable, rules = "));
+	out.print(num_rules);
+	out.print(F(", pending = "));
+	out.print(num_pending);
+	out.print(F(", dropped = "));
+	out.print(num_dropped);
+	out.print(F(", latency min/avg/max = "));
+	out.print(lat_min / 1000);
+	out.print('/');
+	out.print(lat_count ? lat_sum / lat_count / 1000 : 0);
+	out.print('/');
+	out.print(lat_max / 1000);
+	out.println(F(" ms>"));
+}
+
+void RuleTable::save(size_t i, byte * buf) const
+{
+	const Rule & r = rules[i];
+	memset(buf, 0, saved_size);
+	put_u32(buf, r.key);
+	buf[4] = r.group;
+	buf[5] = r.channel;
+	buf[6] = r.state;
+	buf[7] = r.action.is_scene;
+	if (r.action.is_scene)
+		memcpy(buf + 8, r.action.scene, strlen(r.action.scene));
+	else
+		put_u32(buf + 8, r.action.cmd.pack().value());
+	put_u32(buf + 16, r.delay);
+	put_u32(buf + 20, r.cooldown);
+}
+
+bool RuleTable::load(const byte * buf)
+{
+	Rule rule;
+	rule.key = get_u32(buf);
+	rule.group = buf[4];
+	rule.channel = buf[5];
+	rule.state = buf[6];
+	if (!PackedCommand(rule.key << PackedCommand::version_shift).valid() ||
+	    (rule.group > 1 && rule.group != ANY) ||
+	    (rule.channel > 15 && rule.channel != ANY) ||
+	    (rule.state > 1 && rule.state != ANY))
+		return false;
+
+	Action & a = rule.action;
+	a.is_scene = buf[7];
+	if (a.is_scene) {
+		memcpy(a.scene, buf + 8, max_scene_name);
+		a.scene[max_scene_name] = '\0';
+		if (!a.scene[0])
+			return false;
+	}
+	else {
+		PackedCommand cmd(get_u32(buf + 8));
+		if (!cmd.valid())
+			return false;
+		NexaCommand::from_packed(a.cmd, cmd);
+	}
+	rule.delay = get_u32(buf + 16);
+	rule.cooldown = get_u32(buf + 20);
+	if (rule.delay > max_ms || rule.cooldown > max_ms)
+		return false;
+	return insert(rule);
+}
+
+bool RuleTable::insert(Rule & rule)
+{
+	rule.fired = false;
+	rule.last_fired = 0;
+	if (num_rules == max_rules)
+		return false;
+	size_t i = lower_bound(rule.key + 1); // after rules with equal key
+	memmove(rules + i + 1, rules + i, (num_rules - i) * sizeof(Rule));
+	rules[i] = rule;
+	++num_rules;
+	return true;
+}
+
+size_t RuleTable::lower_bound(uint32_t key) const
+{
+	size_t lo = 0, hi = num_rules;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (rules[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+bool RuleTable::parse_match(Rule & rule, const char * buf, size_t len)
+{
+	// Substitute wildcards with valid digits, and parse as a command
+	char tmp[NexaCommand::cmd_str_len];
+	if (len != sizeof(tmp))
+		return false;
+	memcpy(tmp, buf, len);
+	const size_t wild[] = { 9, 11, 13 }; // positions of G, C, S
+	for (size_t i = 0; i < ARRAY_LENGTH(wild); ++i) {
+		if (tmp[wild[i]] == '*')
+			tmp[wild[i]] = '0';
+	}
+
+	NexaCommand cmd;
+	if (!NexaCommand::from_cmd_str(cmd, tmp, len))
+		return false;
+	rule.key = cmd.pack().device_key();
+	rule.group = buf[9] == '*' ? ANY : cmd.group;
+	rule.channel = buf[11] == '*' ? ANY : cmd.channel;
+	rule.state = buf[13] == '*' ? ANY : cmd.state;
+	return true;
+}
+
+bool RuleTable::parse_action(Action & action, const char * buf,
+			     size_t len)
+{
+	if (len && buf[0] == '@') {
+		if (len < 2 || len - 1 > max_scene_name)
+			return false;
+		action.is_scene = true;
+		memcpy(action.scene, buf + 1, len - 1);
+		action.scene[len - 1] = '\0';
+		return true;
+	}
+	action.is_scene = false;
+	return NexaCommand::from_cmd_str(action.cmd, buf, len);
+}
+
+bool RuleTable::parse_ms(unsigned long & ms, const char * buf, size_t len)
+{
+	if (!len)
+		return false;
+	ms = 0;
+	for (size_t i = 0; i < len; ++i) {
+		if (buf[i] < '0' || buf[i] > '9')
+			return false;
+		unsigned long digit = buf[i] - '0';
+		if (ms > (max_ms - digit) / 10)
+			return false; // out of range
+		ms = ms * 10 + digit;
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef NEXA_NODE_SCENE_TABLE_H
+#define NEXA_NODE_SCENE_TABLE_H
+
+#include "Macros.h"
+#include "NexaCommand.h"
+#include "TxQueue.h"
+
+#include <string.h>
+
+/*
+ * Named scenes: lists of Nexa commands that are transmitted together.
+ *
+ * A scene is triggered by name with a single call, and its commands are
+ * queued back to back on a TxQueue. The given frame cache (see
+ * FrameCache) is used to compute the airtime of the scene, which also
+ * makes sure the encoded frames are ready when the queue is transmitted.
+ *
+ * The Cache type must provide: const PulseSchedule & lookup(NexaCommand).
+ */
+template<typename Cache>
+class SceneTable {
+public: // types & constants
+	static const size_t max_scenes = 4;
+	static const size_t max_cmds = 8; // per scene
+	static const size_t max_name_len = 8;
+
+	struct Scene {
+		char name[max_name_len + 1]; // empty name == unused slot
+		NexaCommand cmds[max_cmds];
+		byte num_cmds;
+		byte queued; // # of commands queued by last trigger
+		unsigned long triggered; // # of times queued in full
+		unsigned long airtime; // µs needed for last trigger
+	};
+
+	// Return the number of repetitions to use for the given command
+	typedef byte (*RepsFunc)(const NexaCommand & cmd);
+
+public: // initializers
+	SceneTable(Cache & cache) : cache(cache)
+	{
+		for (size_t i = 0; i < max_scenes; ++i)
+			scenes[i].name[0] = '\0';
+	}
+
+public: // commands
+	/*
+	 * Define, redefine or remove a scene from a string of the form
+	 * "NAME=CMD,CMD,...", where each CMD is a command string of the
+	 * form accepted by NexaCommand::from_cmd_str(). An empty list of
+	 * commands ("NAME=") removes the scene.
+	 *
+	 * Return true on success, or false if the string is invalid, or
+	 * if there is no room for another scene.
+	 */
+	bool define(const char * buf, size_t len);
+
+	/*
+	 * Define, redefine or remove (num_cmds == 0) the named scene from
+	 * the given commands.
+	 *
+	 * Return false if the name or number of commands is invalid, or
+	 * if there is no room for another scene.
+	 */
+	bool define(const char * name, size_t name_len,
+		    const NexaCommand * cmds, size_t num_cmds);
+
+	/*
+	 * Queue all commands in the named scene for transmission, each
+	 * repeated the number of times given by reps_for(). The given
+	 * time (ms) and origin (µs) are passed on to TxQueue::push().
+	 *
+	 * Return the scene that was triggered, or NULL if no such scene
+	 * exists. Commands that do not fit in the queue are dropped; the
+	 * scene's queued and airtime then only cover those that did.
+	 */
+	const Scene * trigger(const char * name, size_t name_len,
+			      TxQueue & queue, RepsFunc reps_for,
+			      unsigned long now, unsigned long origin = 0);
+
+public: // queries
+	// Return the named scene, or NULL if no such scene exists.
+	Scene * find(const char * name, size_t name_len);
+
+	// Return the i-th scene slot (i < max_scenes); empty name == unused
+	const Scene & slot(size_t i) const { return scenes[i]; }
+
+	// Return the number of defined scenes.
+	size_t size() const
+	{
+		size_t n = 0;
+		for (size_t i = 0; i < max_scenes; ++i)
+			n += scenes[i].name[0] != '\0';
+		return n;
+	}
+
+	// Print a one-line summary of the given scene.
+	static void print(Print & out, const Scene & scene);
+
+private: // helpers
+	Scene * free_slot();
+
+private: // representation
+	Cache & cache;
+	Scene scenes[max_scenes];
+};
+
+template<typename Cache>
+bool SceneTable<Cache>::define(const char * buf, size_t len)
+{
+	const char * eq = (const char *) memchr(buf, '=', len);
+	if (!eq)
+		return false;
+	size_t name_len = eq - buf;
+	if (!name_len || name_len > max_name_len)
+		return false;
+
+	// Parse commands before touching the table
+	NexaCommand cmds[max_cmds];
+	size_t num_cmds = 0;
+	const char * p = eq + 1;
+	const char * end = buf + len;
+	while (p < end) {
+		if (num_cmds == max_cmds)
+			return false;
+		const char * sep = (const char *) memchr(p, ',', end - p);
+		size_t cmd_len = (sep ? sep : end) - p;
+		if (!NexaCommand::from_cmd_str(cmds[num_cmds++], p, cmd_len))
+			return false;
+		p += cmd_len + 1;
+	}
+	return define(buf, name_len, cmds, num_cmds);
+}
+
+template<typename Cache>
+bool SceneTable<Cache>::define(const char * name, size_t name_len,
+			       const NexaCommand * cmds, size_t num_cmds)
+{
+	if (!name_len || name_len > max_name_len || num_cmds > max_cmds)
+		return false;
+
+	Scene * scene = find(name, name_len);
+	if (!num_cmds) { // remove scene
+		if (scene)
+			scene->name[0] = '\0';
+		return scene != NULL;
+	}
+	if (!scene && !(scene = free_slot()))
+		return false;
+
+	memcpy(scene->name, name, name_len);
+	scene->name[name_len] = '\0';
+	for (size_t i = 0; i < num_cmds; ++i)
+		scene->cmds[i] = cmds[i];
+	scene->num_cmds = num_cmds;
+	scene->queued = 0;
+	scene->triggered = 0;
+	scene->airtime = 0;
+	return true;
+}
+
+template<typename Cache>
+const typename SceneTable<Cache>::Scene * SceneTable<Cache>::trigger(
+	const char * name, size_t name_len,
+	TxQueue & queue, RepsFunc reps_for, unsigned long now,
+	unsigned long origin)
+{
+	Scene * scene = find(name, name_len);
+	if (!scene)
+		return NULL;
+
+	unsigned long airtime = 0;
+	byte queued = 0;
+	for (size_t i = 0; i < scene->num_cmds; ++i) {
+		const PulseSchedule & sched = cache.lookup(scene->cmds[i]);
+		byte reps = reps_for(scene->cmds[i]);
+		if (!queue.push(scene->cmds[i], reps, now, origin))
+			continue;
+		airtime += sched.airtime(reps);
+		++queued;
+	}
+	if (queued == scene->num_cmds)
+		scene->triggered++;
+	scene->queued = queued;
+	scene->airtime = airtime;
+	return scene;
+}
+
+template<typename Cache>
+typename SceneTable<Cache>::Scene * SceneTable<Cache>::find(
+	const char * name, size_t name_len)
+{
+	if (name_len > max_name_len)
+		return NULL;
+	for (size_t i = 0; i < max_scenes; ++i) {
+		if (scenes[i].name[0] &&
+		    strncmp(scenes[i].name, name, name_len) == 0 &&
+		    scenes[i].name[name_len] == '\0')
+			return &scenes[i];
+	}
+	return NULL;
+}
+
+template<typename Cache>
+void SceneTable<Cache>::print(Print & out, const Scene & scene)
+{
+	out.print(F("SCENE "));
+	out.print(scene.name);
+	out.print(F(": "));
+	out.print(scene.num_cmds);
+	out.print(F(" cmds, "));
+	out.print(scene.queued);
+	out.print(F(" queued, triggered "));
+	out.print(scene.triggered);
+	out.print(F(" times, airtime "));
+	out.print(scene.airtime / 1000);
+	out.println(F(" ms"));
+}
+
+template<typename Cache>
+typename SceneTable<Cache>::Scene * SceneTable<Cache>::free_slot()
+{
+	for (size_t i = 0; i < max_scenes; ++i) {
+		if (!scenes[i].name[0])
+			return &scenes[i];
+	}
+	return NULL;
+}
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef NEXA_NODE_SCHEDULER_H
+#define NEXA_NODE_SCHEDULER_H
+
+#include "Macros.h"
+
+/*
+ * Small cooperative, time-budgeted task scheduler.
+ *
+ * Tasks are registered with a priority, a per-slot time budget, a period
+ * and a maximum latency. Every call to run() starts a new round, in which
+ * each task that is due is given a slot, in priority order. A task is
+ * expected to return before its budget is used up; long-running tasks
+ * can check time_left() to decide when to yield.
+ *
+ * Once the round budget is used up, the remaining (lower priority) tasks
+ * are postponed to the next round. A task that is still waiting more than
+ * its maximum latency after it became due has missed its deadline; it is
+ * then run even if the round budget is used up, so that it cannot be
+ * starved forever. Tasks registered without a maximum latency get one
+ * period (or, for tasks that run every round, one round budget) as their
+ * deadline, so every task is postponed for a bounded time. Deadline
+ * misses, and slots that run longer than the task's budget (overruns),
+ * are counted per task.
+ *
+ * Time is read from the given clock function (µs), which makes it
+ * possible to drive the scheduler from a simulated clock.
+ */
+class Scheduler {
+public: // types & constants
+	static const size_t max_tasks = 8;
+
+	typedef unsigned long (*Clock)();
+	typedef void (*TaskFunc)();
+
+	struct Task {
+		const char * name;
+		TaskFunc func;
+		byte priority; // lower value == more urgent
+		unsigned long budget; // max µs per slot
+		unsigned long period; // µs between runs (0 == every round)
+		unsigned long max_latency; // µs until deadline, see deadline()
+
+		unsigned long due; // next time the task should run
+		bool late; // deadline missed since task became due
+		unsigned long runs;
+		unsigned long overruns;
+		unsigned long misses;
+		unsigned long max_time; // longest slot so far (µs)
+	};
+
+public: // initializers
+	Scheduler(Clock clock, unsigned long round_budget)
+		: clock(clock), round_budget(round_budget), num_tasks(0),
+		  cur_task(NULL), slot_start(0), num_rounds(0) { }
+
+	/*
+	 * Register a task. Tasks with equal priority run in the order they
+	 * were added.
+	 *
+	 * Return false if there is no room for another task.
+	 */
+	bool add(const char * name, TaskFunc func, byte priority,
+		 unsigned long budget, unsigned long period = 0,
+		 unsigned long max_latency = 0);
+
+public: // commands
+	// Run one round of all due tasks.
+	void run();
+
+public: // queries
+	/*
+	 * Return the number of µs left of the current task's budget, or 0
+	 * if the budget is used up (or no task is running).
+	 */
+	unsigned long time_left() const
+	{
+		if (!cur_task)
+			return 0;
+		unsigned long used = clock() - slot_start;
+		return used < cur_task->budget ? cur_task->budget - used : 0;
+	}
+
+	unsigned long rounds() const { return num_rounds; }
+	size_t size() const { return num_tasks; }
+	const Task & operator[](size_t i) const
+	{
+		ASSERT(i < num_tasks);
+		return tasks[i];
+	}
+
+	void print(Print & out) const;
+
+private: // helpers
+	// Return the µs from due until the given task misses its deadline.
+	unsigned long deadline(const Task & t) const
+	{
+		if (t.max_latency)
+			return t.max_latency;
+		return t.period ? t.period : round_budget;
+	}
+
+	// Return true iff time t has been reached at time now.
+	static bool reached(unsigned long now, unsigned long t)
+	{
+		return long(now - t) >= 0;
+	}
+
+private: // representation
+	const Clock clock;
+	const unsigned long round_budget; // µs
+	Task tasks[max_tasks]; // sorted by priority
+	size_t num_tasks;
+	Task * cur_task;
+	unsigned long slot_start;
+	unsigned long num_rounds;
+};
+
+bool Scheduler::add(const char * name, TaskFunc func, byte priority,
+		    unsigned long budget, unsigned long period,
+		    unsigned long max_latency)
+{
+	if (num_tasks == max_tasks)
+		return false;
+
+	size_t i = num_tasks++;
+	for (; i > 0 && tasks[i - 1].priority > priority; --i)
+		tasks[i] = tasks[i - 1];
+
+	Task & t = tasks[i];
+	t.name = name;
+	t.func = func;
+	t.priority = priority;
+	t.budget = budget;
+	t.period = period;
+	t.max_latency = max_latency;
+	t.due = clock();
+	t.late = false;
+	t.runs = t.overruns = t.misses = t.max_time = 0;
+	return true;
+}
+
+void Scheduler::run()
+{
+	unsigned long round_start = clock();
+	++num_rounds;
+	for (size_t i = 0; i < num_tasks; ++i) {
+		Task & t = tasks[i];
+		unsigned long now = clock();
+		if (!reached(now, t.due))
+			continue;
+		if (!t.late && now - t.due > deadline(t)) {
+			t.late = true;
+			++t.misses;
+		}
+		if (now - round_start >= round_budget && !t.late)
+			continue; // postpone until next round
+
+		cur_task = &t;
+		slot_start = now;
+		t.func();
+		cur_task = NULL;
+		t.late = false;
+
+		unsigned long elapsed = clock() - slot_start;
+		++t.runs;
+		if (elapsed > t.budget)
+			++t.overruns;
+		if (elapsed > t.max_time)
+			t.max_time = elapsed;
+
+		// Schedule next run relative to when the task became due,
+		// unless we have fallen more than a period behind
+		t.due += t.period;
+		if (reached(now, t.due + t.period))
+			t.due = now + t.period;
+	}
+}
+
+void Scheduler::print(Print & out) const
+{
+	out.print(F("<Scheduler, rounds = "));
+	out.print(num_rounds);
+	out.println(F(">"));
+	for (size_t i = 0; i < num_tasks; ++i) {
+		const Task & t = tasks[i];
+		out.print(F("  "));
+		out.print(t.name);
+		out.print(F(": runs = "));
+		out.print(t.runs);
+		out.print(F(", overruns = "));
+		out.print(t.overruns);
+		out.print(F(", misses = "));
+		out.print(t.misses);
+		out.print(F(", max = "));
+		out.print(t.max_time);
+		out.println(F(" us"));
+	}
+}
+
+#endif
@@ -0,0 +1,333 @@
+#ifndef NEXA_NODE_STATE_STORE_H
+#define NEXA_NODE_STATE_STORE_H
+
+#include "Macros.h"
+#include "PackedCommand.h"
+#include "NexaCommand.h"
+#include "DeviceRegistry.h"
+#include "RuleTable.h"
+#include "LogStore.h"
+
+#include <string.h>
+
+/*
+ * Persistent node state: the last received command, the paired channels
+ * and on/off states of known devices, scenes and rules, kept in a
+ * LogStore so that they survive a reboot.
+ *
+ * Changes are not written as they happen. Instead, the owner marks the
+ * state as changed (see on_receive() and touch()), and then runs a sync
+ * pass, which writes the records that differ from what is stored. A
+ * pass is split into short steps (see sync()), so that it can be done
+ * between frames. The store is read back once, by restore(), at boot.
+ *
+ * Records are keyed by their kind in the low byte, and a slot number in
+ * the upper 24 bits. Values are:
+ *  - LAST_CMD: the packed command (see PackedCommand), 4 bytes
+ *  - DEVICE: device id, paired channel mask, on/off mask and whether the
+ *    channels were set by pair() (0/1), 3 + 2 + 2 + 1 bytes, for the
+ *    device in the given DeviceRegistry slot
+ *  - SCENE: name (NUL-padded), followed by its packed commands
+ *  - RULE: the rule, as saved by RuleTable::save()
+ * All integers are little-endian.
+ *
+ * Only as many devices, scenes and rules are saved as fit in the store
+ * (see LogStore::capacity()); on a small medium, this can be less than
+ * the tables hold. Saving never limits the tables: what does not fit is
+ * kept in RAM only, and counted by unsaved().
+ *
+ * The Scenes type must be a SceneTable.
+ */
+template<typename Scenes>
+class StateStore {
+public: // types & constants
+	enum Kind {
+		LAST_CMD = 1,
+		DEVICE = 2,
+		SCENE = 3,
+		RULE = 4,
+	};
+
+	// Size of each kind of record in the store
+	static const size_t last_size = LogStore::record_overhead + 4;
+	static const size_t device_size = LogStore::record_overhead + 8;
+	static const size_t scene_size = LogStore::record_overhead +
+		Scenes::max_name_len + 4 * Scenes::max_cmds;
+	static const size_t rule_size =
+		LogStore::record_overhead + RuleTable::saved_size;
+
+public: // initializers
+	StateStore(LogStore & log, DeviceRegistry & registry,
+		   Scenes & scenes, RuleTable & rules)
+		: log(log), registry(registry), scenes(scenes), rules(rules),
+		  last(), changed(false), cursor(0), num_unsaved(0),
+		  pass_unsaved(0), device_cap(0), scene_cap(0), rule_cap(0),
+		  reserved(0), largest(0) { }
+
+	/*
+	 * Mount the store, and restore devices, scenes and rules from it.
+	 *
+	 * Return the last received command (invalid if none was saved).
+	 */
+	PackedCommand restore();
+
+public: // commands
+	// Record the given command as the last received one.
+	void on_receive(PackedCommand cmd)
+	{
+		last = cmd;
+		changed = true;
+	}
+
+	// Note that devices, scenes or rules may have changed.
+	void touch() { changed = true; }
+
+	/*
+	 * Run the next step of the current sync pass, or start a new one:
+	 * write at most max_records changed records, or compact the store
+	 * (which is then the only write in this step).
+	 */
+	void sync(size_t max_records);
+
+public: // queries
+	// Return true if there are changes that no sync pass has covered.
+	bool dirty() const { return changed; }
+
+	// Return true if a sync pass is in progress.
+	bool syncing() const { return cursor; }
+
+	// Return # of devices/scenes/rules left out of the last sync pass.
+	size_t unsaved() const { return num_unsaved; }
+
+	void print(Print & out) const;
+
+private: // helpers
+	static const size_t num_items = 1 + DeviceRegistry::max_devices +
+		Scenes::max_scenes + RuleTable::max_rules;
+
+	static uint32_t key(Kind kind, uint32_t slot)
+	{
+		return slot << 8 | kind;
+	}
+
+	/*
+	 * Reserve room for up to max_count records of the given size, out
+	 * of the store capacity that is still unreserved. Enough room is
+	 * kept free to put a new version of the largest reserved record
+	 * (see LogStore::put()).
+	 */
+	size_t reserve(size_t size, size_t max_count);
+
+	/*
+	 * Set key, and the value in buf, of the n-th item of a sync pass.
+	 * Return the length of the value (0 == the key should be removed).
+	 * Set lost if there is an item that does not fit in the store.
+	 */
+	size_t item(size_t n, uint32_t & k, byte * buf, bool & lost) const;
+
+	static void put_u16(byte * p, uint16_t v)
+	{
+		p[0] = v;
+		p[1] = v >> 8;
+	}
+	static void put_u32(byte * p, uint32_t v)
+	{
+		put_u16(p, v);
+		put_u16(p + 2, v >> 16);
+	}
+	static uint16_t get_u16(const byte * p) { return p[0] | p[1] << 8; }
+	static uint32_t get_u32(const byte * p)
+	{
+		return get_u16(p) | (uint32_t) get_u16(p + 2) << 16;
+	}
+
+private: // representation
+	LogStore & log;
+	DeviceRegistry & registry;
+	Scenes & scenes;
+	RuleTable & rules;
+	PackedCommand last;
+	bool changed; // since the current sync pass started
+	size_t cursor; // next item of the current sync pass
+
+	size_t num_unsaved; // in the last complete sync pass
+	size_t pass_unsaved; // in the current sync pass
+
+	// # of devices/scenes/rules that fit in the store
+	size_t device_cap;
+	size_t scene_cap;
+	size_t rule_cap;
+	size_t reserved; // bytes, see reserve()
+	size_t largest; // reserved record
+};
+
+template<typename Scenes>
+PackedCommand StateStore<Scenes>::restore()
+{
+	reserved = largest = 0;
+	reserve(last_size, 1);
+	device_cap = reserve(device_size, DeviceRegistry::max_devices);
+	scene_cap = reserve(scene_size, Scenes::max_scenes);
+	rule_cap = reserve(rule_size, RuleTable::max_rules);
+
+	log.mount();
+
+	byte buf[LogStore::max_value];
+	if (log.get(key(LAST_CMD, 0), buf, sizeof(buf)) == 4)
+		last = PackedCommand(get_u32(buf));
+
+	for (size_t i = 0; i < DeviceRegistry::max_devices; ++i) {
+		if (log.get(key(DEVICE, i), buf, sizeof(buf)) == 8)
+			registry.restore(get_u16(buf) | (uint32_t) buf[2] << 16,
+					 get_u16(buf + 3), get_u16(buf + 5),
+					 buf[7]);
+	}
+
+	const size_t name_len = Scenes::max_name_len;
+	for (size_t i = 0; i < Scenes::max_scenes; ++i) {
+		size_t len = log.get(key(SCENE, i), buf, sizeof(buf));
+		if (len <= name_len)
+			continue;
+		NexaCommand cmds[Scenes::max_cmds];
+		size_t num_cmds = MIN((len - name_len) / 4, Scenes::max_cmds);
+		for (size_t j = 0; j < num_cmds; ++j)
+			NexaCommand::from_packed(cmds[j],
+				PackedCommand(get_u32(buf + name_len + 4 * j)));
+		const byte * nul = (const byte *) memchr(buf, '\0', name_len);
+		scenes.define((const char *) buf, nul ? nul - buf : name_len,
+			      cmds, num_cmds);
+	}
+
+	for (size_t i = 0; i < RuleTable::max_rules; ++i) {
+		if (log.get(key(RULE, i), buf, sizeof(buf)) ==
+		    RuleTable::saved_size)
+			rules.load(buf);
+	}
+
+	changed = false;
+	cursor = 0;
+	return last;
+}
+
+template<typename Scenes>
+void StateStore<Scenes>::sync(size_t max_records)
+{
+	if (!cursor) { // start a new pass
+		changed = false;
+		pass_unsaved = 0;
+	}
+
+	size_t written = 0;
+	while (cursor < num_items && written < max_records) {
+		byte buf[LogStore::max_value];
+		uint32_t k;
+		bool lost = false;
+		size_t len = item(cursor, k, buf, lost);
+		if (!log.holds(k, buf, len)) {
+			bool compact = !log.fits(len);
+			if (compact && written)
+				break; // compact at the start of the next step
+			if (!log.put(k, buf, len))
+				lost = true;
+			++written;
+			if (compact)
+				written = max_records;
+		}
+		pass_unsaved += lost;
+		++cursor;
+	}
+
+	if (cursor == num_items) {
+		cursor = 0;
+		num_unsaved = pass_unsaved;
+	}
+}
+
+template<typename Scenes>
+void StateStore<Scenes>::print(Print & out) const
+{
+	out.print(F("<StateStore, saved devices/scenes/rules = "));
+	out.print(device_cap);
+	out.print('/');
+	out.print(scene_cap);
+	out.print('/');
+	out.print(rule_cap);
+	out.print(F(", unsaved = "));
+	out.print(num_unsaved);
+	out.println(F(">"));
+}
+
+template<typename Scenes>
+size_t StateStore<Scenes>::reserve(size_t size, size_t max_count)
+{
+	size_t count = 0;
+	while (count < max_count &&
+	       reserved + size + MAX(largest, size) <= log.capacity()) {
+		reserved += size;
+		largest = MAX(largest, size);
+		++count;
+	}
+	return count;
+}
+
+template<typename Scenes>
+size_t StateStore<Scenes>::item(size_t n, uint32_t & k, byte * buf,
+				bool & lost) const
+{
+	if (n == 0) {
+		k = key(LAST_CMD, 0);
+		if (!last.valid())
+			return 0;
+		put_u32(buf, last.value());
+		return 4;
+	}
+	n -= 1;
+
+	if (n < DeviceRegistry::max_devices) {
+		k = key(DEVICE, n);
+		if (n >= registry.size())
+			return 0;
+		if (n >= device_cap) {
+			lost = true;
+			return 0;
+		}
+		const DeviceRegistry::Device & d = registry[n];
+		put_u16(buf, d.id);
+		buf[2] = d.id >> 16;
+		put_u16(buf + 3, d.channels);
+		put_u16(buf + 5, d.states);
+		buf[7] = d.configured;
+		return 8;
+	}
+	n -= DeviceRegistry::max_devices;
+
+	if (n < Scenes::max_scenes) {
+		k = key(SCENE, n);
+		const typename Scenes::Scene & scene = scenes.slot(n);
+		if (!scene.name[0])
+			return 0;
+		if (n >= scene_cap) {
+			lost = true;
+			return 0;
+		}
+		size_t len = Scenes::max_name_len;
+		memset(buf, 0, len);
+		memcpy(buf, scene.name, strlen(scene.name));
+		for (size_t j = 0; j < scene.num_cmds; ++j, len += 4)
+			put_u32(buf + len, scene.cmds[j].pack().value());
+		return len;
+	}
+	n -= Scenes::max_scenes;
+
+	k = key(RULE, n);
+	if (n >= rules.size())
+		return 0;
+	if (n >= rule_cap) {
+		lost = true;
+		return 0;
+	}
+	rules.save(n, buf);
+	return RuleTable::saved_size;
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef NEXA_NODE_TX_QUEUE_H
+#define NEXA_NODE_TX_QUEUE_H
+
+#include "Macros.h"
+#include "NexaCommand.h"
+
+/*
+ * Queue of Nexa commands waiting to be transmitted.
+ *
+ * Commands are not transmitted immediately, but collected into a batch
+ * until no new command has been pushed for batch_window ms. This gives
+ * planners (see GroupPlanner) a chance to rewrite the batch before it is
+ * transmitted.
+ *
+ * Unlike RingBuffer, entries may be replaced and removed anywhere in the
+ * queue. The queue is not ISR-safe.
+ */
+class TxQueue {
+public: // types & constants
+	static const size_t capacity = 16;
+
+	// Time to wait for more commands before a batch is ready (ms)
+	static const unsigned long batch_window = 100;
+
+	struct Entry {
+		NexaCommand cmd;
+		byte reps;
+		unsigned long origin; // µs timestamp of trigger (0 == none)
+	};
+
+public: // initializers
+	TxQueue() : len(0), last_push(0), drop_count(0) { }
+
+public: // commands
+	/*
+	 * Append the given command to the queue, to be repeated the given
+	 * number of times. The given time (in ms) is used to determine
+	 * when the current batch is ready(). The origin is the time (in
+	 * µs) of the event that caused this command, if any, and is used
+	 * to measure end-to-end latency.
+	 *
+	 * Return false (and drop the command) if the queue is full.
+	 */
+	bool push(const NexaCommand & cmd, size_t reps, unsigned long now,
+		  unsigned long origin = 0)
+	{
+		last_push = now;
+		if (len == capacity) {
+			++drop_count;
+			return false;
+		}
+		entries[len].cmd = cmd;
+		entries[len].reps = reps;
+		entries[len].origin = origin;
+		++len;
+		return true;
+	}
+
+	// Remove the entry at the given position, preserving the order.
+	void remove(size_t i)
+	{
+		ASSERT(i < len);
+		for (--len; i < len; ++i)
+			entries[i] = entries[i + 1];
+	}
+
+	// Consume and return the first entry. The queue must not be empty.
+	Entry pop()
+	{
+		ASSERT(len);
+		Entry e = entries[0];
+		remove(0);
+		return e;
+	}
+
+public: // queries
+	bool empty() const { return !len; }
+	size_t size() const { return len; }
+	unsigned long dropped() const { return drop_count; }
+
+	Entry & operator[](size_t i) { ASSERT(i < len); return entries[i]; }
+	const Entry & operator[](size_t i) const
+	{
+		ASSERT(i < len);
+		return entries[i];
+	}
+
+	/*
+	 * Return true iff there are entries in the queue, and no entry
+	 * has been pushed during the last batch_window ms.
+	 */
+	bool ready(unsigned long now) const
+	{
+		return len && now - last_push >= batch_window;
+	}
+
+private: // representation
+	Entry entries[capacity];
+	size_t len;
+	unsigned long last_push;
+	unsigned long drop_count;
+};
+
+#endif
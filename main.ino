@@ -12,35 +12,173 @@
  */
 
 #include "Macros.h"
+#include "CycleClock.h"
 #include "RF433Transceiver.h"
 #include "RingBuffer.h"
 #include "PulseParser.h"
+#include "PulseFilter.h"
+#include "LinkMonitor.h"
 #include "NexaCommand.h"
+#include "FrameCache.h"
+#include "SceneTable.h"
+#include "DeviceRegistry.h"
+#include "TxQueue.h"
+#include "GroupPlanner.h"
+#include "Scheduler.h"
+#include "RuleTable.h"
+#include "Repeater.h"
+#include "RepeatTuner.h"
+#include "DutyCycle.h"
+#include "EventOutbox.h"
+#include "OutputRing.h"
+#include "LogStore.h"
+#include "EepromMedium.h"
+#include "StateStore.h"
 
+#include <stdio.h>
 
+// Default number of times each transmitted command is repeated
+const size_t tx_reps = 5;
+
+// Allowed TX duty cycle (permille), and max burst of airtime (µs)
+const unsigned int tx_duty_cycle = 100;
+const unsigned long tx_burst = 4000000;
+
+// Commands that would have to wait longer than this for the duty cycle
+// limiter are rejected (ms)
+const unsigned long tx_max_delay = 30000;
+
+// RX pulses shorter than this are treated as glitches (µs)
+const int rx_glitch_width = 100;
+
+// Interval between printing statistics on serial (µs)
+const unsigned long stats_interval = 60000000;
+
+// Period of the housekeeping task, which prints one section per run (µs)
+const unsigned long stats_period = 100000;
+
+// Max bytes written to the serial port per run of the serial task
+const size_t serial_chunk = 64;
+
+// Max time spent in one round of the task scheduler (µs)
+const unsigned long round_budget = 10000;
+
+// Min interval between passes writing state changes to the EEPROM (ms)
+const unsigned long persist_interval = 10000;
+
+// Period of the persist task (µs), and max records written per run
+const unsigned long persist_period = 100000;
+const size_t persist_records = 2;
+
+// Number of segments the EEPROM is divided into (see LogStore)
+const size_t store_segments = 2;
+
+// Time to wait for a cloud connection before trying again (ms)
+const unsigned long cloud_retry_interval = 60000;
 
 RF433Transceiver rf_port = RF433Transceiver();
+RingBuffer<int> rx_pulses(256); // captured RX pulses (CPU cycles)
 RingBuffer<char> rx_bits(1000);
-PulseParser pulse_parser(rx_bits);
+RingBuffer<FrameTiming> rx_timings(16);
+PulseParser pulse_parser(rx_bits, &rx_timings);
+PulseFilter pulse_filter(pulse_parser, rx_glitch_width);
 NexaCommand in_cmd, out_cmd;
+typedef FrameCache<8> TxFrameCache;
+typedef SceneTable<TxFrameCache> TxSceneTable;
+TxFrameCache frame_cache;
+TxSceneTable scenes(frame_cache);
+DeviceRegistry registry;
+TxQueue tx_queue;
+GroupPlanner group_planner(registry);
+LinkMonitor link_monitor(rx_timings, tx_reps);
+Scheduler scheduler(micros, round_budget);
+RuleTable rules(fireRule);
+Repeater repeater;
+RepeatTuner repeat_tuner(tx_reps);
+DutyCycle duty_cycle(tx_duty_cycle, tx_burst);
+EventOutbox rx_outbox;
+OutputRing<1024> serial_out; // drained onto Serial by serialTask()
+EepromMedium eeprom;
+LogStore log_store(eeprom, store_segments);
+StateStore<TxSceneTable> state_store(log_store, registry, scenes, rules);
 
 int LED = D7; // This one is the built-in tiny one to the right of the USB jack
 
-SYSTEM_MODE(AUTOMATIC);
+// Run setup() and the RF path right away; connect to the cloud later
+SYSTEM_MODE(SEMI_AUTOMATIC);
 
 bool LED_ON = true;
 
 char command[NexaCommand::cmd_str_len] = F("NO RECEIVED");
+char scene_status[64] = "";
+char link_status[256] = "";
+bool tx_sending = false;
+bool tx_deferred = false;
+unsigned long tx_wait_until = 0; // ms
+int duty_status = 0; // band utilisation (permille)
+unsigned long rx_frame_end = 0; // µs
+bool cloud_connecting = false;
+unsigned long cloud_connect_start = 0; // ms
+bool cloud_online = false;
+int boot_rx_ms = -1; // time from boot to first decoded frame (ms)
+unsigned long persist_pass_start = 0; // ms
+unsigned long stats_due = 0; // µs
+int stats_section = 0; // next section to print (0 == none)
 
 void setup()
 {
+    rf_port.rx_begin_capture(rx_pulses);
+    restoreState();
+
+    // Registrations are queued until the cloud connection is up
     Spark.variable("command", command, STRING);
+    Spark.variable("scenestat", scene_status, STRING);
+    Spark.variable("links", link_status, STRING);
+    Spark.variable("duty", &duty_status, INT);
+    Spark.variable("bootrx", &boot_rx_ms, INT);
     Spark.function("send", sendCommand);
+    Spark.function("scene", sceneCommand);
+    Spark.function("config", configCommand);
 
     pinMode(LED, OUTPUT);
     digitalWrite(LED, HIGH);
     Serial.begin(9600);
-    Serial.println(F("nexa_comm ready:"));
+
+    // name, function, priority, budget, period, max latency (µs)
+    scheduler.add("rx", rxTask, 0, 2000);
+    scheduler.add("decode", decodeTask, 1, 2000, 0, 50000);
+    scheduler.add("rules", rulesTask, 2, 1000, 10000, 50000);
+    scheduler.add("tx", txTask, 2, 500000);
+    scheduler.add("serial", serialTask, 3, 2000, 10000, 100000);
+    scheduler.add("cloud", cloudTask, 4, 5000);
+    scheduler.add("housekeeping", housekeepingTask, 5, 20000,
+        stats_period, 1000000);
+    scheduler.add("persist", persistTask, 5, 50000, persist_period,
+        1000000);
+
+    serial_out.print(F("nexa_comm ready after "));
+    serial_out.print(millis());
+    serial_out.println(F(" ms:"));
+}
+
+/*
+ * Restore devices, scenes, rules and the last received command, as saved
+ * by persistTask() before the last reboot.
+ */
+void restoreState()
+{
+    unsigned long start = micros();
+    PackedCommand last = state_store.restore();
+    if (last.valid()) {
+        NexaCommand cmd;
+        NexaCommand::from_packed(cmd, last);
+        cmd.to_cmd_str().toCharArray(command, NexaCommand::cmd_str_len + 1);
+    }
+    serial_out.print(F("State restored in "));
+    serial_out.print(micros() - start);
+    serial_out.print(F(" us: "));
+    log_store.print(serial_out);
+    state_store.print(serial_out);
 }
 
 void toggleLed() {
@@ -54,53 +192,456 @@ int sendCommand(String inCommand)
     inCommand.toCharArray(commandBuf, NexaCommand::cmd_str_len + 1);
     
     if (NexaCommand::from_cmd_str(out_cmd, commandBuf, NexaCommand::cmd_str_len)) {
-        for (size_t i = 0; i < 5; i++) {
-            out_cmd.transmit(rf_port);
-            Serial.print("TX -> ");
-            out_cmd.print(Serial);
-        }
-        return 1;
+        return tx_queue.push(out_cmd, txReps(out_cmd), millis()) ? 1 : -1;
     }
     else return -1;
 }
 
-void loop()
+/*
+ * Trigger a scene ("NAME"), or define/remove one ("NAME=CMD,CMD,...").
+ *
+ * Return the airtime (in ms) of a triggered scene, 0 when a scene was
+ * defined/removed, or -1 on failure, including when not all of the
+ * scene's commands fit in the TX queue.
+ */
+int sceneCommand(String arg)
+{
+    const char * buf = arg.c_str();
+    size_t len = arg.length();
+
+    const char * eq = strchr(buf, '=');
+    if (eq) {
+        state_store.touch();
+        return scenes.define(buf, len) ? 0 : -1;
+    }
+
+    const TxSceneTable::Scene * scene =
+        scenes.trigger(buf, len, tx_queue, txReps, millis());
+    if (!scene)
+        return -1;
+
+    TxSceneTable::print(serial_out, *scene);
+    frame_cache.print(serial_out);
+    snprintf(scene_status, sizeof(scene_status),
+        "%s:%u:%lu:%u", scene->name, scene->num_cmds,
+        scene->airtime / 1000, frame_cache.hit_rate());
+    if (scene->queued < scene->num_cmds)
+        return -1; // TX queue full
+    return scene->airtime / 1000;
+}
+
+/*
+ * Configure the node. Supported settings:
+ *  - "pair:DDDDDD:MMMM": set the paired channels of 24-bit device id
+ *    DDDDDD (hex) to the 16-bit channel mask MMMM (hex). Only devices
+ *    paired this way have their commands collapsed into group commands.
+ *  - "rule:MATCH>ACTION,DELAY,COOLDOWN": add (or remove) a local
+ *    automation rule; see RuleTable::define().
+ *  - "repeat:V:DDDDDD:N": repeat commands received from version V,
+ *    24-bit device id DDDDDD (hex) N times (hex digit); N = 0 stops
+ *    repeating.
+ *  - "fail:V:DDDDDD:G:C:S": report that the given transmitted command
+ *    did not take effect, so that more repetitions are used.
+ *  - "duty:N": limit our TX duty cycle to N permille (decimal).
+ *
+ * Return 1 on success, or -1 on failure.
+ */
+int configCommand(String arg)
 {
-    bool busy = FALSE;
+    const char * buf = arg.c_str();
+    size_t len = arg.length();
+    byte dev[3], mask[2];
 
-    while (busy = pulse_parser(rf_port.rx_get_pulse())) {
+    if (len == 16 && strncmp(buf, "pair:", 5) == 0 && buf[11] == ':' &&
+        Hex::hex2bytes(dev, buf + 5, 3) && Hex::hex2bytes(mask, buf + 12, 2)) {
+        unsigned long id = (unsigned long) dev[0] << 16 | dev[1] << 8 | dev[2];
+        state_store.touch();
+        return registry.pair(id, mask[0] << 8 | mask[1]) ? 1 : -1;
+    }
+    if (strncmp(buf, "rule:", 5) == 0) {
+        state_store.touch();
+        return rules.define(buf + 5, len - 5) ? 1 : -1;
+    }
+    if (len == 17 && strncmp(buf, "repeat:", 7) == 0 && buf[8] == ':' &&
+        buf[15] == ':' && Hex::hex2bytes(dev, buf + 9, 3) &&
+        Hex::parse_digit(buf[16]) != -1) {
+        int v = Hex::parse_digit(buf[7]);
+        if (v <= NexaCommand::NEXA_INVAL || v >= NexaCommand::NEXA_END)
+            return -1;
+        unsigned long id = (unsigned long) dev[0] << 16 | dev[1] << 8 | dev[2];
+        uint32_t key = PackedCommand::make(v, id, false, 0, false).device_key();
+        return repeater.set_device(key, Hex::parse_digit(buf[16])) ? 1 : -1;
+    }
+    if (strncmp(buf, "fail:", 5) == 0) {
+        NexaCommand cmd;
+        if (!NexaCommand::from_cmd_str(cmd, buf + 5, len - 5))
+            return -1;
+        repeat_tuner.report_failure(cmd);
+        return 1;
     }
+    if (len > 5 && strncmp(buf, "duty:", 5) == 0) {
+        long permille = atol(buf + 5);
+        if (permille <= 0 || permille > 1000)
+            return -1;
+        duty_cycle.set_permille(permille);
+        return 1;
+    }
+    return -1;
+}
 
-    if (!rx_bits.r_empty()) {
-        //Serial.write((const byte *) rx_bits.r_buf(),
-        //     rx_bits.r_buf_len());
-        //Serial.write((const byte *) rx_bits.r_wrapped_buf(),
-        //     rx_bits.r_wrapped_buf_len());
-        if (NexaCommand::from_bit_buffer(in_cmd, rx_bits)) {
-            toggleLed();
-            Serial.println();
-            Serial.print("RX <- ");
-            in_cmd.print(Serial);
+/*
+ * Return the number of times to repeat the given command.
+ */
+byte txReps(const NexaCommand & cmd)
+{
+    return repeat_tuner.reps_for(cmd);
+}
 
-            in_cmd.to_cmd_str().toCharArray(command, NexaCommand::cmd_str_len + 1);
+/*
+ * Fire the action of a local automation rule. Commands that do not fit
+ * in the TX queue are reported on serial.
+ */
+void fireRule(const RuleTable::Action & action, unsigned long origin)
+{
+    size_t dropped = 0;
+    if (action.is_scene) {
+        const TxSceneTable::Scene * scene = scenes.trigger(action.scene,
+            strlen(action.scene), tx_queue, txReps, millis(), origin);
+        if (scene)
+            dropped = scene->num_cmds - scene->queued;
+    }
+    else if (!tx_queue.push(action.cmd, txReps(action.cmd), millis(), origin))
+        dropped = 1;
+    if (dropped) {
+        serial_out.print("Rule action: TX queue full, dropped ");
+        serial_out.print(dropped);
+        serial_out.println(" commands");
+    }
+}
+
+/*
+ * Return the time (µs) at which the last pulse passed to the parser
+ * ended: the last captured RX edge, minus the length of all pulses that
+ * are still waiting in the capture buffer and in the glitch filter.
+ *
+ * This is computed on the cycle counter, and then mapped onto micros(),
+ * which (unlike the cycle counter) does not wrap around within the
+ * lifetime of a delayed rule action.
+ */
+unsigned long rxParsedEnd()
+{
+    CycleClock::ticks_t t = rf_port.rx_last_edge() -
+        CycleClock::from_us(pulse_filter.held());
+    const int * p = rx_pulses.r_buf();
+    for (size_t i = 0; i < rx_pulses.r_buf_len(); ++i)
+        t -= abs(p[i]);
+    p = rx_pulses.r_wrapped_buf();
+    for (size_t i = 0; i < rx_pulses.r_wrapped_buf_len(); ++i)
+        t -= abs(p[i]);
+    return micros() - CycleClock::to_us(
+        CycleClock::elapsed(t, CycleClock::now()));
+}
+
+/*
+ * Drain captured RX pulses (in CPU cycles) through the glitch filter into
+ * the parser, keeping the full capture resolution for link statistics.
+ *
+ * Once all pulses are drained, the filter is told how long the pulse in
+ * progress has lasted, so that it can pass on the last pulse of a frame
+ * without waiting for the next edge. The last edge is read before the
+ * buffer is checked, so that an edge in between is not missed.
+ */
+void rxTask()
+{
+    while (!rx_pulses.r_empty() && scheduler.time_left()) {
+        size_t frames = rx_timings.r_available();
+        int ticks = rx_pulses.r_pop();
+        int usecs = CycleClock::to_us(abs(ticks));
+        pulse_filter(ticks < 0 ? -usecs : usecs,
+                     CycleClock::to_us16(abs(ticks)));
+        if (rx_timings.r_available() != frames)
+            rx_frame_end = rxParsedEnd();
+    }
+
+    CycleClock::ticks_t last_edge = rf_port.rx_last_edge();
+    if (rx_pulses.r_empty()) {
+        size_t frames = rx_timings.r_available();
+        pulse_filter.flush(CycleClock::to_us(
+            CycleClock::elapsed(last_edge, CycleClock::now())));
+        if (rx_timings.r_available() != frames)
+            rx_frame_end = rxParsedEnd();
+    }
+}
+
+/*
+ * Decode parsed bits into Nexa commands, and report them.
+ */
+void decodeTask()
+{
+    while (scheduler.time_left() &&
+           NexaCommand::from_bit_buffer(in_cmd, rx_bits)) {
+        toggleLed();
+        if (boot_rx_ms < 0) {
+            boot_rx_ms = millis();
+            serial_out.println();
+            serial_out.print("First frame decoded after ");
+            serial_out.print(boot_rx_ms);
+            serial_out.print(" ms");
         }
+        serial_out.println();
+        serial_out.print("RX <- ");
+        in_cmd.print(serial_out);
+        rx_outbox.post(in_cmd.pack(), millis());
+        registry.learn(in_cmd);
+        state_store.on_receive(in_cmd.pack());
+        link_monitor.update(in_cmd, millis());
+        rules.on_command(in_cmd, millis(), rx_frame_end);
+        repeater.on_command(in_cmd, millis());
+        repeat_tuner.on_receive(in_cmd, millis());
+
+        in_cmd.to_cmd_str().toCharArray(command, NexaCommand::cmd_str_len + 1);
     }
-    else if (!busy && Serial.available() >= NexaCommand::cmd_str_len) {
-        char buf[NexaCommand::cmd_str_len];
-        size_t buf_read = Serial.readBytesUntil(
-            '\n', buf, NexaCommand::cmd_str_len);
-        Serial.println();
-        Serial.print("Read ");
-        Serial.print(buf_read);
-        Serial.print(" bytes: ");
-        Serial.write((const byte *) buf, buf_read);
-        Serial.println();
-        if (NexaCommand::from_cmd_str(out_cmd, buf, buf_read)) {
-            for (size_t i = 0; i < 5; i++) {
-                out_cmd.transmit(rf_port);
-                Serial.print("TX -> ");
-                out_cmd.print(Serial);
-            }
+}
+
+/*
+ * Fire delayed rule actions, and queue repeated commands whose original
+ * burst has ended.
+ */
+void rulesTask()
+{
+    rules.tick(millis());
+
+    NexaCommand cmd;
+    byte reps;
+    while (!pulse_filter.busy() && repeater.poll(cmd, reps, millis()))
+        tx_queue.push(cmd, reps, millis());
+}
+
+/*
+ * Transmit the pending batch of commands, one command per slot, after
+ * letting the group planner collapse it. Transmission is held back
+ * while a frame is being received, and while the duty cycle limiter
+ * does not admit the next command; commands that would be held back for
+ * too long are rejected.
+ */
+void txTask()
+{
+    repeat_tuner.tick(millis());
+    if (pulse_filter.busy() || tx_queue.empty())
+        return;
+    if (!tx_sending) {
+        if (!tx_queue.ready(millis()))
+            return;
+        group_planner.plan(tx_queue);
+        tx_sending = true;
+    }
+    if (tx_deferred && long(millis() - tx_wait_until) < 0)
+        return;
+
+    const TxQueue::Entry & head = tx_queue[0];
+    const PulseSchedule & sched = frame_cache.lookup(head.cmd);
+    unsigned long airtime = sched.airtime(head.reps);
+    if (!duty_cycle.admit(airtime, millis())) {
+        unsigned long wait = duty_cycle.wait_time(airtime);
+        if (wait > tx_max_delay) {
+            duty_cycle.reject();
+            serial_out.print("TX rejected (duty cycle) -> ");
+            head.cmd.print(serial_out);
+            tx_queue.pop();
+            tx_deferred = false;
+        }
+        else {
+            if (!tx_deferred)
+                duty_cycle.defer();
+            tx_deferred = true;
+            tx_wait_until = millis() + wait;
+            return;
         }
     }
+    else {
+        tx_deferred = false;
+        TxQueue::Entry e = tx_queue.pop();
+        if (e.origin)
+            rules.record_latency(micros() - e.origin);
+        sched.play(rf_port, e.reps);
+        repeat_tuner.on_transmit(e.cmd, e.reps,
+            sched.airtime(1) - sched.airtime(0), millis());
+        registry.learn(e.cmd);
+        state_store.touch();
+        duty_status = duty_cycle.utilisation(millis());
+        serial_out.print("TX -> ");
+        e.cmd.print(serial_out);
+    }
+
+    if (tx_queue.empty()) {
+        tx_sending = false;
+        if (group_planner.collapsed())
+            group_planner.print(serial_out);
+    }
+}
+
+/*
+ * Drain buffered output onto the serial port, and read and queue Nexa
+ * commands from it.
+ *
+ * Not all firmware versions can tell how much the port takes without
+ * blocking (availableForWrite()), so a small fixed chunk is written per
+ * run instead, which fits in the USB serial buffer.
+ */
+void serialTask()
+{
+    serial_out.drain(Serial, serial_chunk);
+
+    if (Serial.available() < (int) NexaCommand::cmd_str_len)
+        return;
+
+    char buf[NexaCommand::cmd_str_len];
+    size_t buf_read = Serial.readBytesUntil(
+        '\n', buf, NexaCommand::cmd_str_len);
+    serial_out.println();
+    serial_out.print("Read ");
+    serial_out.print(buf_read);
+    serial_out.print(" bytes: ");
+    serial_out.write((const byte *) buf, buf_read);
+    serial_out.println();
+    if (NexaCommand::from_cmd_str(out_cmd, buf, buf_read))
+        tx_queue.push(out_cmd, txReps(out_cmd), millis());
+}
+
+/*
+ * Bring up the cloud connection in the background, and publish received
+ * commands (as "nexa-rx" events with data "CMD,AGE_MS") once connected.
+ *
+ * Connecting is started while no frame is being received, since the
+ * handshake holds up the main loop. When the connection is lost, or is
+ * not up within cloud_retry_interval, connecting is started again.
+ * Commands received while offline are delivered from the outbox after
+ * connecting.
+ */
+void cloudTask()
+{
+    if (!Spark.connected()) {
+        if (cloud_online) {
+            cloud_online = false;
+            cloud_connecting = false;
+            serial_out.println();
+            serial_out.print("Cloud connection lost after ");
+            serial_out.print(millis());
+            serial_out.println(" ms");
+        }
+        if (cloud_connecting &&
+            millis() - cloud_connect_start >= cloud_retry_interval)
+            cloud_connecting = false; // try again
+        if (!cloud_connecting && !pulse_filter.busy()) {
+            Spark.connect();
+            cloud_connecting = true;
+            cloud_connect_start = millis();
+        }
+        Spark.process();
+        return;
+    }
+    if (!cloud_online) {
+        cloud_online = true;
+        cloud_connecting = false;
+        serial_out.println();
+        serial_out.print("Cloud connected after ");
+        serial_out.print(millis());
+        serial_out.print(" ms (");
+        serial_out.print(rf_port.rx_dropped());
+        serial_out.println(" RX pulses dropped)");
+    }
+
+    EventOutbox::Event e;
+    if (!pulse_filter.busy() && rx_outbox.poll(e, millis())) {
+        NexaCommand cmd;
+        NexaCommand::from_packed(cmd, e.cmd);
+        char data[32];
+        cmd.to_cmd_str().toCharArray(data, sizeof(data));
+        size_t len = strlen(data);
+        snprintf(data + len, sizeof(data) - len, ",%lu", millis() - e.time);
+        Spark.publish("nexa-rx", data);
+    }
+    Spark.process();
+}
+
+/*
+ * Refresh statistics every stats_interval, and print them on serial.
+ *
+ * All statistics together do not fit in serial_out, so they are printed
+ * one section per run, each once the previous one has been drained. No
+ * section is longer than serial_out; the longest are the scheduler
+ * (about 800 bytes with all tasks) and the links (up to about 520).
+ */
+void housekeepingTask()
+{
+    if (long(micros() - stats_due) >= 0) {
+        stats_due = micros() + stats_interval;
+        link_monitor.format(link_status, sizeof(link_status));
+        duty_status = duty_cycle.utilisation(millis());
+        stats_section = 1; // (re)start printing
+    }
+    if (!stats_section || serial_out.available())
+        return;
+
+    switch (stats_section++) {
+    case 1:
+        rf_port.print(serial_out);
+        pulse_filter.print(serial_out);
+        pulse_parser.print(serial_out);
+        break;
+    case 2:
+        link_monitor.print(serial_out);
+        break;
+    case 3:
+        rules.print(serial_out);
+        repeater.print(serial_out);
+        break;
+    case 4:
+        repeat_tuner.print(serial_out, 0, RepeatTuner::max_devices / 2);
+        break;
+    case 5:
+        repeat_tuner.print(serial_out, RepeatTuner::max_devices / 2,
+            RepeatTuner::max_devices / 2);
+        break;
+    case 6:
+        rx_outbox.print(serial_out);
+        duty_cycle.print(serial_out);
+        break;
+    case 7:
+        scheduler.print(serial_out);
+        break;
+    case 8:
+        log_store.print(serial_out);
+        state_store.print(serial_out);
+        break;
+    default:
+        serial_out.print_stats(serial_out);
+        stats_section = 0;
+        break;
+    }
+}
+
+/*
+ * Write state changes to the EEPROM, in passes no more often than every
+ * persist_interval. Writing stalls the CPU whenever the EEPROM emulation
+ * erases a flash page, so each run writes at most persist_records
+ * records (or compacts the store), and only while no frame is being
+ * received; a pass is spread over as many runs as needed.
+ */
+void persistTask()
+{
+    if (pulse_filter.busy())
+        return;
+    if (!state_store.syncing()) {
+        if (!state_store.dirty() ||
+            millis() - persist_pass_start < persist_interval)
+            return;
+        persist_pass_start = millis();
+    }
+    state_store.sync(persist_records);
+}
+
+void loop()
+{
+    scheduler.run();
 }
@@ -0,0 +1,118 @@
+/*
+ * Host test for the TX duty-cycle limiter (DutyCycle.h).
+ *
+ * The limiter is driven by a fake ms clock, with the limit and burst
+ * capacity used by main.ino (10%, 4 s of airtime). Checks that:
+ *
+ *  - a full bucket admits a burst of exactly its capacity, and no more
+ *  - tokens refill at the duty cycle, as predicted by wait_time(), and
+ *    never beyond the capacity
+ *  - transmissions that can never be admitted are reported as such
+ *  - a sender that transmits as much as it is allowed to is held to the
+ *    duty cycle, and utilisation() reports it; after an idle window,
+ *    utilisation() drops back to 0
+ *  - all of the above holds across wraparound of the ms clock
+ *
+ * Build and run (from the top of the repository):
+ *
+ *     g++ -std=c++11 -O2 -I. -Itools/host -o duty_cycle_test \
+ *         tools/duty_cycle_test.cpp && ./duty_cycle_test
+ *
+ * Exits with status 1 if any test fails.
+ */
+
+#include "spark_host.h"
+#include "DutyCycle.h"
+
+static int failures = 0;
+
+#define CHECK(expr) do { \
+	if (!(expr)) { \
+		printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+		++failures; \
+	} \
+} while (0)
+
+static const unsigned int permille = 100; // as in main.ino
+static const unsigned long capacity = 4000000; // µs
+static const unsigned long hour = 3600000; // ms
+
+static void test_burst(unsigned long t0)
+{
+	DutyCycle dc(permille, capacity);
+	unsigned long now = t0;
+	dc.admit(0, now); // start refilling from t0
+
+	// 40 transmissions of 100 ms fit in the burst capacity
+	for (size_t i = 0; i < 40; ++i)
+		CHECK(dc.admit(100000, now));
+	CHECK(!dc.admit(1, now));
+
+	// 100 ms of airtime takes 1 s to earn at 10%
+	CHECK(dc.wait_time(100000) == 1000);
+	now += 999;
+	CHECK(!dc.admit(100000, now));
+	CHECK(dc.wait_time(100000) == 1);
+	now += 1;
+	CHECK(dc.admit(100000, now));
+	CHECK(!dc.admit(1, now));
+
+	// Refill stops at the capacity
+	now += hour;
+	CHECK(dc.admit(capacity, now));
+	CHECK(!dc.admit(1, now));
+}
+
+static void test_never()
+{
+	DutyCycle dc(permille, capacity);
+	CHECK(dc.wait_time(capacity + 1) == ULONG_MAX);
+	CHECK(!dc.admit(capacity + 1, 0));
+	dc.set_permille(0);
+	CHECK(dc.wait_time(1) == ULONG_MAX);
+}
+
+static void test_sustained(unsigned long t0)
+{
+	DutyCycle dc(permille, capacity);
+	unsigned long now = t0;
+	dc.admit(0, now);
+
+	// Transmit 500 ms frames as fast as allowed, for two hours
+	const unsigned long airtime = 500000;
+	unsigned long sent = 0, last_hour = 0;
+	for (; now - t0 < 2 * hour; ++now) {
+		if (dc.admit(airtime, now)) {
+			sent += airtime;
+			if (now - t0 >= hour)
+				last_hour += airtime;
+		}
+	}
+	// Burst, then 10% of the time: 4 s + 720 s
+	printf("sustained: %lu ms of airtime in 2 h, %lu ms in the last "
+	       "hour, utilisation %u permille\n", sent / 1000,
+	       last_hour / 1000, dc.utilisation(now));
+	CHECK(sent <= capacity + 2 * hour * permille);
+	CHECK(sent + airtime >= capacity + 2 * hour * permille);
+	CHECK(last_hour / 1000 <= hour * permille / 1000 + airtime / 1000);
+
+	// The window holds between 59 and 60 one-minute buckets
+	unsigned int u = dc.utilisation(now);
+	CHECK(u >= permille * 59 / 60 - 1 && u <= permille);
+
+	// After an idle window, nothing is left
+	CHECK(dc.utilisation(now + DutyCycle::window_len / 2) > 0);
+	CHECK(dc.utilisation(now + DutyCycle::window_len) == 0);
+}
+
+int main()
+{
+	const unsigned long t0[] = { 0, 123456, ULONG_MAX - 30 * 60000 };
+	for (size_t i = 0; i < ARRAY_LENGTH(t0); ++i) {
+		test_burst(t0[i]);
+		test_sustained(t0[i]);
+	}
+	test_never();
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * Benchmark of the RX pulse filter (PulseFilter.h) on a synthetic capture.
+ *
+ * The capture is what the RX module produces in a busy band: random
+ * noise pulses (20µs - 3ms), interrupted every -i ms by a 32-bit Nexa
+ * command with 5 repetitions, encoded by NexaCommand::encode(). After
+ * the last repetition, the output stays LOW for -a µs while the module's
+ * AGC recovers, before the noise resumes. A given fraction of the pulses
+ * of each frame is cut in two by a glitch (a short pulse of the opposite
+ * level), as caused by interference.
+ *
+ * The capture is decoded with every pulse fed straight into the
+ * PulseParser, and through the PulseFilter (as on the node). For each,
+ * the number of parser calls, the CPU time per pulse spent in the filter
+ * and parser, and the number of decoded frames are printed. Commands
+ * decoded from noise, long after any frame, are counted as false. The
+ * latency is measured from the end of a frame's last pulse until it is
+ * decoded, with the filter flushed (see PulseFilter::flush()) every -p
+ * µs, as rxTask() does, and without.
+ *
+ * Build (from the top of the repository):
+ *
+ *     g++ -std=c++11 -O2 -I. -Itools/host -o filter_bench \
+ *         tools/filter_bench.cpp
+ *
+ * Usage: filter_bench [-s SECONDS] [-i MSECS] [-g PERMILLE] [-a USECS]
+ *                     [-p USECS]
+ *
+ *   -s SECONDS   length of the capture (default: 600)
+ *   -i MSECS     interval between commands (default: 500)
+ *   -g PERMILLE  fraction of frame pulses with a glitch (default: 5)
+ *   -a USECS     quiet LOW after the last frame (default: 3000); with 0,
+ *                a noise glitch right after a frame is merged into its
+ *                last pulse, and that frame is lost
+ *   -p USECS     interval between flushes (default: 1000, must be > 0)
+ *
+ * Exits with status 1 if the filter decodes fewer frames than the bare
+ * parser.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include <getopt.h>
+
+#include "spark_host.h"
+#include "NexaCommand.h"
+#include "PulseFilter.h"
+#include "PulseParser.h"
+#include "PulseSchedule.h"
+#include "RingBuffer.h"
+
+struct Capture {
+	std::vector<int> pulses; // as from rx_get_pulse()
+	std::vector<size_t> frame_ends; // index of last pulse of each frame
+	size_t frames; // # of frames sent
+};
+
+static void make_capture(Capture & cap, unsigned long seconds,
+			 unsigned long interval_ms, unsigned glitch_permille,
+			 int agc_us)
+{
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<double> log_len(log(20.0), log(3000.0));
+	std::uniform_int_distribution<int> glitch_len(20, 80);
+	std::uniform_int_distribution<unsigned> permille(0, 999);
+	std::uniform_int_distribution<unsigned long> id(0, 0xffffff);
+
+	const size_t reps = 5;
+	uint64_t t = 0, next_cmd = 0;
+	bool high = true;
+	cap.frames = 0;
+	while (t < seconds * 1000000ULL) {
+		if (t < next_cmd) { // noise
+			int len = int(exp(log_len(rng)));
+			cap.pulses.push_back(high ? len : -len);
+			high = !high;
+			t += len;
+			continue;
+		}
+
+		NexaCommand cmd;
+		NexaCommand::from_packed(cmd, PackedCommand::make(
+			NexaCommand::NEXA_32BIT, id(rng), false, 3, true));
+		PulseSchedule sched;
+		cmd.encode(sched);
+		if (high) { // end the noise with HIGH; frames start with LOW
+			int len = int(exp(log_len(rng)));
+			cap.pulses.push_back(len);
+			t += len;
+		}
+		for (size_t r = 0; r < reps; ++r) {
+			for (size_t i = 0; i < sched.frame_pulses(); ++i) {
+				int p = sched.frame_pulse(i);
+				t += abs(p);
+				int g = glitch_len(rng);
+				if (permille(rng) < glitch_permille &&
+				    abs(p) > 2 * g) {
+					int first = (abs(p) - g) / 2;
+					int rest = abs(p) - g - first;
+					cap.pulses.push_back(p > 0 ? first : -first);
+					cap.pulses.push_back(p > 0 ? -g : g);
+					p = p > 0 ? rest : -rest;
+				}
+				cap.pulses.push_back(p);
+			}
+			cap.frame_ends.push_back(cap.pulses.size() - 1);
+			++cap.frames;
+		}
+		if (agc_us) { // quiet while the AGC recovers
+			cap.pulses.push_back(-agc_us);
+			t += agc_us;
+			high = true;
+		}
+		else
+			high = false;
+		next_cmd = t + interval_ms * 1000;
+	}
+}
+
+// Commands decoded later than this after a frame came from noise (µs)
+static const unsigned long max_latency = 50000;
+
+struct Result {
+	unsigned long parser_calls;
+	unsigned long frames;
+	unsigned long false_frames; // decoded from noise
+	uint64_t latency_sum; // µs
+	unsigned long latency_max; // µs
+};
+
+/*
+ * Return the CPU time (ns) per pulse of running the capture through the
+ * parser, with or without the filter (best of a few runs). Decoding is
+ * left out, since it is the same either way.
+ */
+static double time_run(const Capture & cap, bool filtered)
+{
+	RingBuffer<char> bits(64);
+	PulseParser parser(bits);
+	PulseFilter filter(parser);
+	auto start = std::chrono::steady_clock::now();
+	if (filtered) {
+		for (size_t i = 0; i < cap.pulses.size(); ++i)
+			filter(cap.pulses[i]);
+	}
+	else {
+		for (size_t i = 0; i < cap.pulses.size(); ++i)
+			parser(cap.pulses[i]);
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() /
+		cap.pulses.size();
+}
+
+/*
+ * Set the best CPU time (ns) per pulse of a few runs of the capture
+ * through the bare parser, and through the filter. The runs alternate,
+ * so that both see the same changes in CPU clock and load.
+ */
+static void time_pulses(const Capture & cap, double & bare, double & filtered)
+{
+	for (int run = 0; run < 10; ++run) {
+		double b = time_run(cap, false), f = time_run(cap, true);
+		if (!run || b < bare)
+			bare = b;
+		if (!run || f < filtered)
+			filtered = f;
+	}
+}
+
+/*
+ * Decode the capture, with or without the filter, flushing the filter
+ * every flush_us µs of each pulse (0 == never). Latencies are measured
+ * from the end of the last pulse of each frame.
+ */
+static void decode(const Capture & cap, bool filtered, unsigned long flush_us,
+		   Result & res)
+{
+	RingBuffer<char> bits(64);
+	PulseParser parser(bits);
+	PulseFilter filter(parser);
+	NexaCommand::BitState state;
+	NexaCommand cmd;
+
+	res = Result();
+	const size_t n = cap.pulses.size();
+	size_t next_end = 0;
+	uint64_t t = 0, frame_end = 0;
+	auto poll = [&](uint64_t now) {
+		while (NexaCommand::from_bit_buffer(cmd, bits, state)) {
+			unsigned long lat = now - frame_end;
+			if (lat > max_latency) {
+				++res.false_frames;
+				continue;
+			}
+			++res.frames;
+			res.latency_sum += lat;
+			res.latency_max = std::max(res.latency_max, lat);
+		}
+	};
+
+	for (size_t i = 0; i < n; ++i) {
+		int p = cap.pulses[i];
+		t += abs(p);
+		if (filtered)
+			filter(p);
+		else {
+			++res.parser_calls;
+			parser(p);
+		}
+		if (next_end < cap.frame_ends.size() &&
+		    i == cap.frame_ends[next_end]) {
+			frame_end = t;
+			++next_end;
+		}
+		poll(t);
+
+		// Flush while the next pulse is in progress
+		if (filtered && flush_us && i + 1 < n) {
+			unsigned long next = abs(cap.pulses[i + 1]);
+			for (unsigned long d = flush_us; d < next; d += flush_us) {
+				filter.flush(d);
+				poll(t + d);
+			}
+		}
+	}
+	if (filtered)
+		res.parser_calls = filter.pulses_passed();
+}
+
+static void report(const char * name, const Result & r, double ns,
+		   size_t pulses, size_t frames)
+{
+	printf("%-17s parser calls = %8lu (%5.1f%%), %5.1f ns/pulse, "
+	       "frames = %lu/%zu (+%lu false), latency avg/max = %llu/%lu "
+	       "us\n", name, r.parser_calls, 100.0 * r.parser_calls / pulses,
+	       ns, r.frames, frames, r.false_frames,
+	       (unsigned long long) (r.frames ? r.latency_sum / r.frames : 0),
+	       r.latency_max);
+}
+
+int main(int argc, char * argv[])
+{
+	unsigned long seconds = 600, interval_ms = 500, flush_us = 1000;
+	unsigned glitches = 5;
+	int agc_us = 3000;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:i:g:a:p:")) != -1) {
+		switch (opt) {
+			case 's': seconds = strtoul(optarg, NULL, 10); break;
+			case 'i': interval_ms = strtoul(optarg, NULL, 10); break;
+			case 'g': glitches = strtoul(optarg, NULL, 10); break;
+			case 'a': agc_us = atoi(optarg); break;
+			case 'p': flush_us = strtoul(optarg, NULL, 10); break;
+			default:
+				flush_us = 0; // print usage
+				break;
+		}
+	}
+	if (!flush_us) {
+		fprintf(stderr, "Usage: %s [-s SECONDS] [-i MSECS] "
+			"[-g PERMILLE] [-a USECS] [-p USECS]\n", argv[0]);
+		return 2;
+	}
+
+	Capture cap;
+	make_capture(cap, seconds, interval_ms, glitches, agc_us);
+	printf("%lu s capture: %zu pulses, %zu frames, %u permille "
+	       "glitched\n", seconds, cap.pulses.size(), cap.frames,
+	       glitches);
+
+	Result bare, filtered, unflushed;
+	decode(cap, false, 0, bare);
+	decode(cap, true, 0, unflushed);
+	decode(cap, true, flush_us, filtered);
+	double bare_ns = 0, filtered_ns = 0;
+	time_pulses(cap, bare_ns, filtered_ns);
+	const size_t n = cap.pulses.size();
+	report("parser only", bare, bare_ns, n, cap.frames);
+	report("filter, no flush", unflushed, filtered_ns, n, cap.frames);
+	report("filter + flush", filtered, filtered_ns, n, cap.frames);
+	return filtered.frames < bare.frames ? 1 : 0;
+}
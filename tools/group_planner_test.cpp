@@ -0,0 +1,137 @@
+/*
+ * Host test for the group command planner (GroupPlanner.h).
+ *
+ * Batches of commands are queued on a TxQueue and planned against a
+ * DeviceRegistry. Checks that:
+ *
+ *  - commands setting all paired channels of a device to the same state
+ *    are collapsed into one group command, in place of the first of them
+ *  - commands for channels that are not paired are left as they are,
+ *    also when one of them comes first in the batch
+ *  - devices with conflicting commands, or whose channels were only
+ *    learned from traffic, are left alone
+ *  - the saved frames are counted for the removed commands only
+ *
+ * Build and run (from the top of the repository):
+ *
+ *     g++ -std=c++11 -O2 -I. -Itools/host -o group_planner_test \
+ *         tools/group_planner_test.cpp && ./group_planner_test
+ *
+ * Exits with status 1 if any test fails.
+ */
+
+#include "spark_host.h"
+#include "NexaCommand.h"
+#include "DeviceRegistry.h"
+#include "TxQueue.h"
+#include "GroupPlanner.h"
+
+static int failures = 0;
+
+#define CHECK(expr) do { \
+	if (!(expr)) { \
+		printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+		++failures; \
+	} \
+} while (0)
+
+static const unsigned long dev = 0x123456;
+static const byte reps = 5;
+
+static NexaCommand command(unsigned long id, byte channel, bool state)
+{
+	NexaCommand cmd;
+	NexaCommand::from_packed(cmd, PackedCommand::make(
+		NexaCommand::NEXA_32BIT, id, false, channel, state));
+	return cmd;
+}
+
+// Queue commands for the given channels of dev, all switched on.
+static void queue_channels(TxQueue & queue, const byte * channels, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		queue.push(command(dev, channels[i], true), reps, 0);
+}
+
+static bool is_group(const TxQueue::Entry & e)
+{
+	return e.cmd.group && e.cmd.device_id() == dev && e.cmd.state;
+}
+
+static void test_paired()
+{
+	DeviceRegistry registry;
+	registry.pair(dev, 0x000e); // channels 1-3
+	GroupPlanner planner(registry);
+	TxQueue queue;
+	const byte channels[] = { 1, 2, 3 };
+	queue_channels(queue, channels, ARRAY_LENGTH(channels));
+	planner.plan(queue);
+
+	CHECK(queue.size() == 1);
+	CHECK(is_group(queue[0]));
+	CHECK(planner.collapsed() == 1);
+	CHECK(planner.frames_saved() == 2 * reps);
+}
+
+static void test_unpaired_head()
+{
+	DeviceRegistry registry;
+	registry.pair(dev, 0x000e); // channels 1-3
+	GroupPlanner planner(registry);
+	TxQueue queue;
+	const byte channels[] = { 5, 1, 2, 0, 3 };
+	queue_channels(queue, channels, ARRAY_LENGTH(channels));
+	planner.plan(queue);
+
+	// Channels 5 and 0 are kept, the group replaces channel 1
+	CHECK(queue.size() == 3);
+	CHECK(!queue[0].cmd.group && queue[0].cmd.channel == 5);
+	CHECK(is_group(queue[1]));
+	CHECK(!queue[2].cmd.group && queue[2].cmd.channel == 0);
+	CHECK(planner.collapsed() == 1);
+	CHECK(planner.frames_saved() == 2 * reps);
+}
+
+static void test_left_alone()
+{
+	DeviceRegistry registry;
+	registry.pair(dev, 0x000e); // channels 1-3
+	GroupPlanner planner(registry);
+
+	// Not all paired channels set
+	TxQueue partial;
+	const byte two[] = { 1, 2 };
+	queue_channels(partial, two, ARRAY_LENGTH(two));
+	planner.plan(partial);
+	CHECK(partial.size() == 2);
+
+	// Conflicting state for an unpaired channel
+	TxQueue conflict;
+	const byte three[] = { 1, 2, 3 };
+	queue_channels(conflict, three, ARRAY_LENGTH(three));
+	conflict.push(command(dev, 5, false), reps, 0);
+	planner.plan(conflict);
+	CHECK(conflict.size() == 4);
+
+	// Channels only learned from traffic
+	DeviceRegistry learned;
+	for (size_t i = 0; i < ARRAY_LENGTH(three); ++i)
+		learned.learn(command(dev, three[i], true));
+	GroupPlanner learned_planner(learned);
+	TxQueue queue;
+	queue_channels(queue, three, ARRAY_LENGTH(three));
+	learned_planner.plan(queue);
+	CHECK(queue.size() == 3);
+
+	CHECK(!planner.collapsed() && !learned_planner.collapsed());
+}
+
+int main()
+{
+	test_paired();
+	test_unpaired_head();
+	test_left_alone();
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures ? 1 : 0;
+}
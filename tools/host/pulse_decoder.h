@@ -0,0 +1,80 @@
+#ifndef NEXA_NODE_PULSE_DECODER_H
+#define NEXA_NODE_PULSE_DECODER_H
+
+#include <unordered_set>
+
+#include "spark_host.h"
+
+#include "NexaCommand.h"
+#include "PackedCommand.h"
+#include "PulseFilter.h"
+#include "PulseParser.h"
+#include "RingBuffer.h"
+
+/*
+ * Run pulses through the node's filter/parser/decoder chain, and collect
+ * the decoded commands, for host tools that extract pulses from
+ * recordings.
+ *
+ * Every decoded command is printed to the given log, prefixed by the
+ * given name and the time of its last pulse (unless quiet). Each decoder
+ * keeps its own state, so several decoders can run in parallel threads.
+ */
+class PulseDecoder {
+public:
+	PulseDecoder(Print & log, const char * name, bool quiet = false)
+		: bits(64), parser(bits), filter(parser), log(log), name(name),
+		  quiet(quiet), num_pulses(0), num_frames(0) { }
+
+	/*
+	 * Feed the given pulse (as produced by rx_get_pulse()), which ended
+	 * at the given time (µs). The optional fine length (1/16 µs) is
+	 * passed on to the parser's timing measurements.
+	 */
+	void operator()(int pulse, uint64_t t, unsigned long fine = 0)
+	{
+		++num_pulses;
+		filter(pulse, fine);
+		NexaCommand cmd;
+		while (NexaCommand::from_bit_buffer(cmd, bits, state)) {
+			++num_frames;
+			distinct.insert(cmd.pack().value());
+			if (quiet)
+				continue;
+			char buf[64];
+			snprintf(buf, sizeof(buf), "%s t=%.6f ", name,
+				 t / 1e6);
+			log.print(buf);
+			cmd.print(log);
+		}
+	}
+
+	// Pass on the last pulse, which the filter holds back.
+	void flush(uint64_t t) { (*this)(-INT_MAX, t); }
+
+	unsigned long pulses() const { return num_pulses; }
+	unsigned long frames() const { return num_frames; }
+	size_t distinct_commands() const { return distinct.size(); }
+
+private:
+	struct Hash {
+		size_t operator()(uint32_t v) const
+		{
+			return PackedCommand(v).hash();
+		}
+	};
+
+	RingBuffer<char> bits;
+	PulseParser parser;
+	PulseFilter filter;
+	NexaCommand::BitState state;
+
+	Print & log;
+	const char * name;
+	const bool quiet;
+	unsigned long num_pulses;
+	unsigned long num_frames;
+	std::unordered_set<uint32_t, Hash> distinct;
+};
+
+#endif
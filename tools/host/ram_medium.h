@@ -0,0 +1,95 @@
+#ifndef NEXA_NODE_RAM_MEDIUM_H
+#define NEXA_NODE_RAM_MEDIUM_H
+
+/*
+ * RAM-backed StoreMedium, for exercising LogStore on the host.
+ *
+ * Besides holding the bytes, the medium counts the writes to each byte
+ * (for checking wear levelling), and can simulate a power loss: after
+ * crash_after(n), the first n bytes are written normally, the next one
+ * is left holding garbage, and all later writes and erases are lost,
+ * until power_on(). Running a sequence of puts with every possible n,
+ * and mounting a fresh LogStore on the result, checks that the store
+ * survives a reset at any byte.
+ *
+ * Include spark_host.h (and LogStore.h) before this file.
+ */
+
+#include <vector>
+
+class RamMedium : public StoreMedium {
+public:
+	RamMedium(size_t size)
+		: data(size, 0xff), wear(size, 0), armed(false), dead(false),
+		  budget(0), garbage(0x5a) { }
+
+	size_t size() const { return data.size(); }
+
+	void read(size_t addr, void * buf, size_t len) const
+	{
+		memcpy(buf, &data[addr], len);
+	}
+
+	void write(size_t addr, const void * buf, size_t len)
+	{
+		const byte * p = (const byte *) buf;
+		for (size_t i = 0; i < len; ++i)
+			store(addr + i, p[i]);
+	}
+
+	void erase(size_t addr, size_t len)
+	{
+		for (size_t i = 0; i < len; ++i)
+			if (data[addr + i] != 0xff)
+				store(addr + i, 0xff);
+	}
+
+	// Lose power after the next n bytes have been written.
+	void crash_after(unsigned long n, byte junk = 0x5a)
+	{
+		armed = true;
+		budget = n;
+		garbage = junk;
+	}
+
+	// Restore power; writes take effect again.
+	void power_on() { armed = dead = false; }
+
+	// Return true if power was lost.
+	bool crashed() const { return dead; }
+
+	// Return the number of writes to the given byte.
+	unsigned long writes(size_t addr) const { return wear[addr]; }
+
+	// Return the highest number of writes to any byte.
+	unsigned long max_writes() const
+	{
+		unsigned long m = 0;
+		for (size_t i = 0; i < wear.size(); ++i)
+			m = MAX(m, wear[i]);
+		return m;
+	}
+
+private:
+	void store(size_t addr, byte b)
+	{
+		if (dead)
+			return;
+		if (armed && !budget--) { // this write is cut short
+			data[addr] = garbage;
+			dead = true;
+		}
+		else
+			data[addr] = b;
+		++wear[addr];
+	}
+
+	std::vector<byte> data;
+	std::vector<unsigned long> wear;
+	bool armed; // crash_after() is in effect
+	bool dead; // power is lost
+	unsigned long budget; // # of bytes left before power loss
+	byte garbage; // left in the byte being written at power loss
+};
+
+#endif
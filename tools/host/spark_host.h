@@ -0,0 +1,185 @@
+#ifndef NEXA_NODE_SPARK_HOST_H
+#define NEXA_NODE_SPARK_HOST_H
+
+/*
+ * Minimal stand-in for the Spark Core/Arduino API, so that the decoder
+ * headers (PulseFilter.h, PulseParser.h, NexaCommand.h, ...) can be
+ * compiled into host tools.
+ *
+ * Only what those headers use is provided: pin I/O is a no-op, micros()
+ * and millis() follow the host's monotonic clock, and Print/Serial/String
+ * implement the subset of the Wiring API that is used for formatting.
+ *
+ * Include this before any of the node's headers, but after all system
+ * headers (FastPort.h #defines abs(), which breaks later system headers).
+ */
+
+// Selects host stand-ins in the node's headers (e.g. CycleClock)
+#define NEXA_NODE_HOST 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <string>
+
+typedef uint8_t byte;
+
+enum { D0, D1, D2, D3, D4, D5, D6, D7 };
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define CHANGE 2
+#define DEC 10
+#define HEX 16
+#define F(s) (s)
+
+inline void pinMode(int, int) { }
+inline void digitalWrite(int, int) { }
+inline int digitalRead(int) { return LOW; }
+inline void attachInterrupt(int, void (*)(), int) { }
+inline void detachInterrupt(int) { }
+inline void noInterrupts() { }
+inline void interrupts() { }
+
+inline unsigned long micros()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+inline unsigned long millis() { return micros() / 1000; }
+
+inline void delayMicroseconds(unsigned int usecs)
+{
+	unsigned long start = micros();
+	while (micros() - start < usecs)
+		; // busy-wait, like the real thing
+}
+
+class String {
+public:
+	String(const char * s = "") : s(s) { }
+	String(int value, int base = DEC)
+	{
+		char buf[16];
+		snprintf(buf, sizeof(buf), base == HEX ? "%x" : "%d", value);
+		s = buf;
+	}
+
+	String & operator+=(const String & other) { s += other.s; return *this; }
+	String & operator+=(const char * other) { s += other; return *this; }
+	String & operator+=(char c) { s += c; return *this; }
+
+	void toUpperCase()
+	{
+		for (size_t i = 0; i < s.size(); ++i)
+			s[i] = toupper(s[i]);
+	}
+
+	void toCharArray(char * buf, unsigned int len) const
+	{
+		if (!len)
+			return;
+		strncpy(buf, s.c_str(), len - 1);
+		buf[len - 1] = '\0';
+	}
+
+	unsigned int length() const { return s.size(); }
+	const char * c_str() const { return s.c_str(); }
+
+private:
+	std::string s;
+};
+
+class Print {
+public:
+	virtual ~Print() { }
+
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t * buf, size_t len)
+	{
+		size_t n = 0;
+		while (len--)
+			n += write(*buf++);
+		return n;
+	}
+	size_t write(const char * s)
+	{
+		return write((const uint8_t *) s, strlen(s));
+	}
+
+	size_t print(const char * s) { return write(s); }
+	size_t print(const String & s) { return write(s.c_str()); }
+	size_t print(char c) { return write((uint8_t) c); }
+	size_t print(unsigned char v, int base = DEC)
+	{
+		return print((unsigned long) v, base);
+	}
+	size_t print(int v, int base = DEC) { return print((long) v, base); }
+	size_t print(unsigned int v, int base = DEC)
+	{
+		return print((unsigned long) v, base);
+	}
+	size_t print(long v, int base = DEC)
+	{
+		if (base != DEC)
+			return print((unsigned long) v, base);
+		char buf[24];
+		snprintf(buf, sizeof(buf), "%ld", v);
+		return write(buf);
+	}
+	size_t print(unsigned long v, int base = DEC)
+	{
+		char buf[24];
+		snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lu", v);
+		return write(buf);
+	}
+	size_t print(double v, int digits = 2)
+	{
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%.*f", digits, v);
+		return write(buf);
+	}
+
+	size_t println() { return write("\r\n"); }
+	template<typename T> size_t println(T v) { return print(v) + println(); }
+	template<typename T> size_t println(T v, int base)
+	{
+		return print(v, base) + println();
+	}
+};
+
+// Print onto a stdio stream.
+class FilePrint : public Print {
+public:
+	FilePrint(FILE * f) : f(f) { }
+
+	using Print::write;
+	size_t write(uint8_t c) { return fputc(c, f) == EOF ? 0 : 1; }
+	size_t write(const uint8_t * buf, size_t len)
+	{
+		return fwrite(buf, 1, len, f);
+	}
+
+private:
+	FILE * f;
+};
+
+// Print into a std::string.
+class StringPrint : public Print {
+public:
+	using Print::write;
+	size_t write(uint8_t c) { str += (char) c; return 1; }
+
+	std::string str;
+};
+
+FilePrint Serial(stdout);
+
+#endif
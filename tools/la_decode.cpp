@@ -0,0 +1,293 @@
+/*
+ * Decode Nexa commands from logic analyzer captures.
+ *
+ * Reads raw captures of the RX module's data output, sampled at MHz
+ * rates by a logic analyzer, and decodes them with the same PulseFilter,
+ * PulseParser and NexaCommand code that runs on the node.
+ *
+ * Two raw formats are supported:
+ *
+ *  - bits:  packed, 1 bit per sample, LSB first within each byte (i.e.
+ *           sample i is bit i % 64 of little-endian 64-bit word i / 64)
+ *  - bytes: 1 byte per sample, where bit -c of each byte is the probe
+ *           (sigrok's "binary" output format for up to 8 channels)
+ *
+ * Captures are memory-mapped, so multi-GB files are streamed through the
+ * page cache instead of being read into memory. Byte captures are first
+ * packed into 64-bit words (16 samples at a time with SSE2, where
+ * available). Transitions are then found a word at a time: the bits that
+ * differ from their predecessor are w ^ (w << 1 | carry), and each set
+ * bit is located with a count-trailing-zeros instruction. Words without
+ * any transitions - the vast majority, at MHz rates - cost one XOR and
+ * one compare.
+ *
+ * The time between transitions becomes a signed µs pulse, as produced
+ * by RF433Transceiver::rx_get_pulse(), and is fed to the PulseFilter,
+ * along with its length in 1/16 µs for the timing measurements.
+ *
+ * Build (from the top of the repository):
+ *
+ *     g++ -std=c++11 -O3 -march=native -I. -Itools/host \
+ *         -o la_decode tools/la_decode.cpp
+ *
+ * Usage: la_decode -s RATE [-f bits|bytes] [-c CHANNEL] [-q] FILE...
+ *
+ *   -s RATE     sample rate in Hz (suffixes k and M are accepted)
+ *   -f FORMAT   capture format (default: bits)
+ *   -c CHANNEL  probe bit within each byte, for -f bytes (default: 0)
+ *   -q          only print per-file summaries
+ */
+
+#include <chrono>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "spark_host.h"
+#include "pulse_decoder.h"
+
+/*
+ * Turn transitions in a stream of 1-bit samples into timed pulses.
+ */
+class EdgeScanner {
+public:
+	EdgeScanner(uint64_t rate, PulseDecoder & dec)
+		: rate(rate), dec(dec), base(0), last_edge(0), last_fine(0),
+		  carry(0), started(false) { }
+
+	/*
+	 * Scan the given word of 64 samples (sample i in bit i). Only the
+	 * lowest n bits are valid (for the last, partial word).
+	 */
+	inline void scan(uint64_t w, unsigned n = 64)
+	{
+		uint64_t t = w ^ (w << 1 | carry);
+		if (n < 64)
+			t &= (1ULL << n) - 1;
+		if (t)
+			edges(w, t);
+		carry = w >> (n - 1) & 1;
+		base += n;
+	}
+
+	// Pass on the pulse in progress at the end of the capture.
+	void finish()
+	{
+		if (!started)
+			return;
+		emit(base, !carry);
+		dec.flush(time_of(base));
+	}
+
+	uint64_t samples() const { return base; }
+
+private:
+	// Emit a pulse for each transition bit set in t.
+	void edges(uint64_t w, uint64_t t)
+	{
+		if (!started) { // the first edge only marks the start
+			unsigned k = __builtin_ctzll(t);
+			last_edge = time_of(base + k);
+			last_fine = fine_of(base + k);
+			started = true;
+			t &= t - 1;
+		}
+		while (t) {
+			unsigned k = __builtin_ctzll(t);
+			emit(base + k, w >> k & 1);
+			t &= t - 1;
+		}
+	}
+
+	// Emit the pulse that ended at the given sample, with a new level.
+	void emit(uint64_t sample, bool new_level)
+	{
+		uint64_t now = time_of(sample);
+		uint64_t fine = fine_of(sample);
+		uint64_t len = MIN(now - last_edge, (uint64_t) INT_MAX);
+		int pulse = new_level ? -int(len) : int(len); // ended level
+		dec(pulse, now, MIN(fine - last_fine, (uint64_t) ULONG_MAX));
+		last_edge = now;
+		last_fine = fine;
+	}
+
+	// Time (µs) and time (1/16 µs) of the given sample
+	uint64_t time_of(uint64_t i) const { return i * 1000000 / rate; }
+	uint64_t fine_of(uint64_t i) const { return i * 16000000 / rate; }
+
+	const uint64_t rate;
+	PulseDecoder & dec;
+	uint64_t base; // index of the next sample
+	uint64_t last_edge; // µs
+	uint64_t last_fine; // 1/16 µs
+	uint64_t carry; // last sample of the previous word
+	bool started;
+};
+
+// Scan a capture of packed bits.
+static void scan_bits(const uint8_t * p, size_t len, EdgeScanner & scanner)
+{
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t w;
+		memcpy(&w, p + i, 8); // little-endian host assumed
+		scanner.scan(w);
+	}
+	if (i < len) {
+		uint64_t w = 0;
+		memcpy(&w, p + i, len - i);
+		scanner.scan(w, (len - i) * 8);
+	}
+}
+
+// Pack bit ch of 64 bytes into a word (sample i in bit i).
+static inline uint64_t pack_bytes(const uint8_t * p, unsigned ch)
+{
+#ifdef __SSE2__
+	uint64_t w = 0;
+	for (unsigned j = 0; j < 4; ++j) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (p + 16 * j));
+		// move the probe bit into the MSB of each byte
+		v = _mm_slli_epi16(v, 7 - ch);
+		w |= (uint64_t) (uint16_t) _mm_movemask_epi8(v) << (16 * j);
+	}
+	return w;
+#else
+	uint64_t w = 0;
+	for (unsigned j = 0; j < 64; ++j)
+		w |= (uint64_t) (p[j] >> ch & 1) << j;
+	return w;
+#endif
+}
+
+// Scan a capture of one byte per sample, probe in bit ch.
+static void scan_bytes(const uint8_t * p, size_t len, unsigned ch,
+		       EdgeScanner & scanner)
+{
+	size_t i = 0;
+	for (; i + 64 <= len; i += 64)
+		scanner.scan(pack_bytes(p + i, ch));
+	if (i < len) {
+		uint64_t w = 0;
+		for (size_t j = 0; i + j < len; ++j)
+			w |= (uint64_t) (p[i + j] >> ch & 1) << j;
+		scanner.scan(w, len - i);
+	}
+}
+
+struct Options {
+	uint64_t rate;
+	bool bytes;
+	unsigned channel;
+	bool quiet;
+};
+
+static bool process_file(const char * path, const Options & opts)
+{
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st)) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+	size_t len = st.st_size;
+	const uint8_t * p = NULL;
+	if (len) {
+		void * m = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (m == MAP_FAILED) {
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+			close(fd);
+			return false;
+		}
+		madvise(m, len, MADV_SEQUENTIAL);
+		p = (const uint8_t *) m;
+	}
+
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point start = Clock::now();
+
+	PulseDecoder dec(Serial, path, opts.quiet);
+	EdgeScanner scanner(opts.rate, dec);
+	if (opts.bytes)
+		scan_bytes(p, len, opts.channel, scanner);
+	else
+		scan_bits(p, len, scanner);
+	scanner.finish();
+
+	double wall = std::chrono::duration<double>(Clock::now() - start)
+		.count();
+	double secs = double(scanner.samples()) / opts.rate;
+	printf("%s: %llu samples (%.1f s), %lu pulses, %lu frames, %zu "
+	       "distinct commands, %.0f Msamples/s, %.1fx real time\n",
+	       path, (unsigned long long) scanner.samples(), secs,
+	       dec.pulses(), dec.frames(), dec.distinct_commands(),
+	       wall > 0 ? scanner.samples() / wall / 1e6 : 0,
+	       wall > 0 ? secs / wall : 0);
+
+	if (len)
+		munmap((void *) p, len);
+	close(fd);
+	return true;
+}
+
+// Parse a sample rate, with an optional k/M suffix.
+static uint64_t parse_rate(const char * s)
+{
+	char * end;
+	double v = strtod(s, &end);
+	if (*end == 'k' || *end == 'K')
+		v *= 1e3;
+	else if (*end == 'M')
+		v *= 1e6;
+	return v > 0 ? uint64_t(v + 0.5) : 0;
+}
+
+static int usage(const char * argv0)
+{
+	fprintf(stderr, "Usage: %s -s RATE [-f bits|bytes] [-c CHANNEL] "
+		"[-q] FILE...\n", argv0);
+	return 2;
+}
+
+int main(int argc, char * argv[])
+{
+	Options opts;
+	opts.rate = 0;
+	opts.bytes = false;
+	opts.channel = 0;
+	opts.quiet = false;
+
+	int c;
+	while ((c = getopt(argc, argv, "s:f:c:q")) != -1) {
+		switch (c) {
+			case 's': opts.rate = parse_rate(optarg); break;
+			case 'f':
+				if (!strcmp(optarg, "bytes"))
+					opts.bytes = true;
+				else if (strcmp(optarg, "bits"))
+					return usage(argv[0]);
+				break;
+			case 'c': opts.channel = atoi(optarg); break;
+			case 'q': opts.quiet = true; break;
+			default: return usage(argv[0]);
+		}
+	}
+	if (optind == argc || !opts.rate || opts.channel > 7)
+		return usage(argv[0]);
+
+	int failed = 0;
+	for (int i = optind; i < argc; ++i)
+		failed += !process_file(argv[i], opts);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,394 @@
+/*
+ * Offline OOK demodulator: decode Nexa commands from recordings.
+ *
+ * Reads 16-bit PCM WAV recordings of 433 MHz OOK traffic - e.g. the
+ * audio/data output of a cheap receiver module, or the AM-demodulated
+ * output of an SDR - and decodes them with the same PulseFilter,
+ * PulseParser and NexaCommand code that runs on the node.
+ *
+ * Each file is streamed in blocks (constant memory, any length), and run
+ * through these stages:
+ *
+ *  1. Envelope: samples are (optionally rectified and) averaged over
+ *     windows of -w µs. This is done with branch-free loops over whole
+ *     blocks, which the compiler vectorizes.
+ *
+ *  2. Slicing: the envelope is compared against an adaptive threshold
+ *     halfway between its (decaying) peak and floor levels, with
+ *     hysteresis of a fraction of the peak-floor contrast. No edges are
+ *     detected while the contrast is below -t (noise).
+ *
+ *  3. Pulses: the time between edges becomes a signed µs pulse (positive
+ *     for HIGH, negative for LOW), as produced by
+ *     RF433Transceiver::rx_get_pulse(), and is fed to the PulseFilter.
+ *
+ * Files are processed in parallel (-j jobs, default: one per CPU). For
+ * each file, the decoded commands are printed with their time offset
+ * (unless -q), followed by a summary with the real-time factor (seconds
+ * of recording processed per second).
+ *
+ * Build (from the top of the repository):
+ *
+ *     g++ -std=c++11 -O3 -march=native -pthread -I. -Itools/host \
+ *         -o ook_demod tools/ook_demod.cpp
+ *
+ * Usage: ook_demod [-j JOBS] [-w USECS] [-t LEVEL] [-r] [-i] [-q] FILE...
+ *
+ *   -j JOBS   number of files to process in parallel
+ *   -w USECS  envelope averaging window (default: 10)
+ *   -t LEVEL  minimum peak-floor contrast, in sample units (default: 1000)
+ *   -r        rectify samples before averaging (for recordings of a
+ *             tone-modulated carrier, use with a window of a few periods)
+ *   -i        invert polarity (carrier present == low level)
+ *   -q        only print per-file summaries
+ */
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+
+#include "spark_host.h"
+#include "pulse_decoder.h"
+
+struct Options {
+	unsigned jobs;
+	unsigned window; // µs
+	float min_contrast;
+	bool rectify;
+	bool invert;
+	bool quiet;
+};
+
+/*
+ * Streaming reader of 16-bit PCM WAV files. Only the first channel of
+ * multi-channel files is returned.
+ */
+class WavReader {
+public:
+	WavReader() : f(NULL), rate(0), channels(0), left(0) { }
+	~WavReader() { if (f) fclose(f); }
+
+	// Open the given file, and parse its header. Return error or NULL.
+	const char * open(const char * path);
+
+	/*
+	 * Read up to max samples into buf. Return the number of samples
+	 * read, 0 at end of data.
+	 */
+	size_t read(int16_t * buf, size_t max);
+
+	unsigned sample_rate() const { return rate; }
+
+private:
+	FILE * f;
+	unsigned rate;
+	unsigned channels;
+	uint64_t left; // bytes of sample data left
+	std::vector<int16_t> frames;
+};
+
+static uint32_t le32(const uint8_t * p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint16_t le16(const uint8_t * p) { return p[0] | p[1] << 8; }
+
+const char * WavReader::open(const char * path)
+{
+	f = fopen(path, "rb");
+	if (!f)
+		return strerror(errno);
+
+	uint8_t hdr[12];
+	if (fread(hdr, 1, 12, f) != 12 || memcmp(hdr, "RIFF", 4) ||
+	    memcmp(hdr + 8, "WAVE", 4))
+		return "not a WAV file";
+
+	bool have_fmt = false;
+	for (;;) {
+		uint8_t chunk[8];
+		if (fread(chunk, 1, 8, f) != 8)
+			return "no data chunk";
+		uint32_t len = le32(chunk + 4);
+		if (!memcmp(chunk, "fmt ", 4)) {
+			uint8_t fmt[16];
+			if (len < 16 || fread(fmt, 1, 16, f) != 16)
+				return "bad fmt chunk";
+			unsigned format = le16(fmt);
+			channels = le16(fmt + 2);
+			rate = le32(fmt + 4);
+			unsigned bits = le16(fmt + 14);
+			if ((format != 1 && format != 0xfffe) || bits != 16)
+				return "not 16-bit PCM";
+			if (!channels || !rate)
+				return "bad fmt chunk";
+			if (fseek(f, len - 16 + (len & 1), SEEK_CUR))
+				return "bad fmt chunk";
+			have_fmt = true;
+		}
+		else if (!memcmp(chunk, "data", 4)) {
+			if (!have_fmt)
+				return "data before fmt chunk";
+			// streamed WAVs may leave the length unset
+			left = (len && len != 0xffffffff) ? len : UINT64_MAX;
+			return NULL;
+		}
+		else if (fseek(f, len + (len & 1), SEEK_CUR))
+			return "truncated file";
+	}
+}
+
+size_t WavReader::read(int16_t * buf, size_t max)
+{
+	size_t frame_size = 2 * channels;
+	size_t want = MIN((uint64_t) max, left / frame_size);
+	if (!want)
+		return 0;
+	if (channels == 1) {
+		size_t n = fread(buf, 2, want, f);
+		left -= n * 2;
+		return n;
+	}
+	frames.resize(want * channels);
+	size_t n = fread(frames.data(), frame_size, want, f);
+	for (size_t i = 0; i < n; ++i)
+		buf[i] = frames[i * channels];
+	left -= n * frame_size;
+	return n;
+}
+
+/*
+ * Envelope detector and adaptive slicer, turning blocks of samples into
+ * timed pulses.
+ */
+class OokDemod {
+public:
+	// Demodulate samples at the given rate (Hz).
+	OokDemod(const Options & opts, unsigned rate)
+		: opts(opts), rate(rate),
+		  decim(MAX(1u, unsigned(rate * (uint64_t) opts.window /
+					 1000000))),
+		  alpha(float(decim) * 1e6f / rate / decay_time),
+		  pos(0), last_edge(0), level(false), started(false),
+		  hi(0), lo(0) { }
+
+	// Process the given samples, feeding pulses to the decoder.
+	void process(const int16_t * samples, size_t n, PulseDecoder & dec);
+
+	// Return the time (µs) up to which samples have been processed.
+	uint64_t time() const { return time_of(pos); }
+
+private:
+	static constexpr float decay_time = 20000; // µs
+	static constexpr float hysteresis = 0.2f; // of peak-floor contrast
+
+	// Compute the averaged envelope of n samples into out.
+	size_t envelope(const int16_t * s, size_t n, float * out);
+
+	// Time (µs) of envelope value number i
+	uint64_t time_of(uint64_t i) const
+	{
+		return i * decim * 1000000 / rate;
+	}
+
+	const Options & opts;
+	const unsigned rate;
+	const unsigned decim;
+	const float alpha;
+
+	uint64_t pos; // index of next envelope value
+	uint64_t last_edge; // index of last edge
+	bool level; // current slicer output
+	bool started; // hi/lo initialized
+	float hi, lo; // tracked peak and floor levels
+	std::vector<int32_t> rect; // scratch
+	std::vector<float> env; // scratch
+};
+
+size_t OokDemod::envelope(const int16_t * s, size_t n, float * out)
+{
+	size_t m = n / decim;
+	int32_t * r = rect.data();
+	// Widen (and rectify) in a pass of its own, so that both this and
+	// the averaging loop below are vectorized
+	if (opts.rectify) {
+		for (size_t i = 0; i < m * decim; ++i)
+			r[i] = s[i] < 0 ? -s[i] : s[i];
+	}
+	else {
+		for (size_t i = 0; i < m * decim; ++i)
+			r[i] = s[i];
+	}
+	float scale = (opts.invert ? -1.0f : 1.0f) / decim;
+	for (size_t j = 0; j < m; ++j) {
+		int32_t sum = 0;
+		const int32_t * w = r + j * decim;
+		for (size_t k = 0; k < decim; ++k)
+			sum += w[k];
+		out[j] = sum * scale;
+	}
+	return m;
+}
+
+void OokDemod::process(const int16_t * samples, size_t n,
+		       PulseDecoder & dec)
+{
+	// Samples that do not fill a whole window are dropped; at most
+	// decim - 1 per block, which is negligible for blocks >> decim.
+	rect.resize(n);
+	env.resize(n / decim + 1);
+	size_t m = envelope(samples, n, env.data());
+
+	for (size_t i = 0; i < m; ++i, ++pos) {
+		float v = env[i];
+		if (!started) {
+			hi = lo = v;
+			started = true;
+		}
+		hi = v > hi ? v : hi - (hi - v) * alpha;
+		lo = v < lo ? v : lo + (v - lo) * alpha;
+
+		float contrast = hi - lo;
+		float mid = (hi + lo) / 2;
+		float h = contrast * hysteresis;
+		bool edge = level ? v < mid - h
+				  : v > mid + h && contrast >= opts.min_contrast;
+		if (!edge)
+			continue;
+
+		uint64_t len = time_of(pos) - time_of(last_edge);
+		int pulse = int(MIN(len, (uint64_t) INT_MAX));
+		dec(level ? pulse : -pulse, time_of(pos));
+		level = !level;
+		last_edge = pos;
+	}
+}
+
+struct FileResult {
+	std::string log;
+	const char * error;
+	double duration; // s of recording
+	double wall; // s of processing
+	unsigned long pulses;
+	unsigned long frames;
+	size_t distinct;
+};
+
+static void process_file(const char * path, const Options & opts,
+			 FileResult & res)
+{
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point start = Clock::now();
+
+	StringPrint log;
+	WavReader wav;
+	res.error = wav.open(path);
+	if (res.error)
+		return;
+
+	PulseDecoder dec(log, path, opts.quiet);
+	OokDemod demod(opts, wav.sample_rate());
+	std::vector<int16_t> buf(1 << 16);
+	uint64_t samples = 0;
+	size_t n;
+	while ((n = wav.read(buf.data(), buf.size()))) {
+		demod.process(buf.data(), n, dec);
+		samples += n;
+	}
+	dec.flush(demod.time());
+
+	res.log = log.str;
+	res.duration = double(samples) / wav.sample_rate();
+	res.wall = std::chrono::duration<double>(Clock::now() - start).count();
+	res.pulses = dec.pulses();
+	res.frames = dec.frames();
+	res.distinct = dec.distinct_commands();
+}
+
+static int usage(const char * argv0)
+{
+	fprintf(stderr, "Usage: %s [-j JOBS] [-w USECS] [-t LEVEL] [-r] "
+		"[-i] [-q] FILE...\n", argv0);
+	return 2;
+}
+
+int main(int argc, char * argv[])
+{
+	Options opts;
+	opts.jobs = std::thread::hardware_concurrency();
+	opts.window = 10;
+	opts.min_contrast = 1000;
+	opts.rectify = false;
+	opts.invert = false;
+	opts.quiet = false;
+
+	int c;
+	while ((c = getopt(argc, argv, "j:w:t:riq")) != -1) {
+		switch (c) {
+			case 'j': opts.jobs = atoi(optarg); break;
+			case 'w': opts.window = atoi(optarg); break;
+			case 't': opts.min_contrast = atof(optarg); break;
+			case 'r': opts.rectify = true; break;
+			case 'i': opts.invert = true; break;
+			case 'q': opts.quiet = true; break;
+			default: return usage(argv[0]);
+		}
+	}
+	if (optind == argc || !opts.window)
+		return usage(argv[0]);
+
+	std::vector<const char *> files(argv + optind, argv + argc);
+	std::vector<FileResult> results(files.size());
+	std::atomic<size_t> next(0);
+	std::mutex out_lock;
+	double total_duration = 0;
+	unsigned long total_frames = 0;
+	int failed = 0;
+
+	std::chrono::steady_clock::time_point start =
+		std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	unsigned jobs = MAX(1u, MIN(opts.jobs, (unsigned) files.size()));
+	for (unsigned j = 0; j < jobs; ++j) {
+		workers.push_back(std::thread([&]() {
+			size_t i;
+			while ((i = next++) < files.size()) {
+				FileResult & r = results[i];
+				process_file(files[i], opts, r);
+
+				std::lock_guard<std::mutex> guard(out_lock);
+				if (r.error) {
+					fprintf(stderr, "%s: %s\n", files[i],
+						r.error);
+					++failed;
+					continue;
+				}
+				fputs(r.log.c_str(), stdout);
+				printf("%s: %.1f s, %lu pulses, %lu frames, "
+				       "%zu distinct commands, %.1fx real "
+				       "time\n", files[i], r.duration,
+				       r.pulses, r.frames, r.distinct,
+				       r.wall > 0 ? r.duration / r.wall : 0);
+				total_duration += r.duration;
+				total_frames += r.frames;
+			}
+		}));
+	}
+	for (size_t j = 0; j < workers.size(); ++j)
+		workers[j].join();
+
+	double wall = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+	printf("total: %zu files, %.1f s, %lu frames in %.2f s with %u "
+	       "jobs, %.1fx real time\n", files.size() - failed,
+	       total_duration, total_frames, wall, jobs,
+	       wall > 0 ? total_duration / wall : 0);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Host test for the local automation rules (RuleTable.h).
+ *
+ * Rules are defined from strings, as by the "config" function, and fed
+ * received commands with a fake ms clock. Checks that:
+ *
+ *  - matching rules fire once per cooldown, and wildcards match
+ *  - delayed actions fire when due, also after the rule was removed
+ *  - with max_pending actions waiting, a further delayed action is
+ *    dropped and counted, and its rule is not marked as fired, so that
+ *    it fires on the next match once there is room again
+ *  - invalid DELAY and COOL fields are rejected
+ *
+ * Build and run (from the top of the repository):
+ *
+ *     g++ -std=c++11 -O2 -I. -Itools/host -o rule_table_test \
+ *         tools/rule_table_test.cpp && ./rule_table_test
+ *
+ * Exits with status 1 if any test fails.
+ */
+
+#include "spark_host.h"
+#include "NexaCommand.h"
+#include "RuleTable.h"
+
+static int failures = 0;
+
+#define CHECK(expr) do { \
+	if (!(expr)) { \
+		printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+		++failures; \
+	} \
+} while (0)
+
+static size_t fired = 0;
+static void fire(const RuleTable::Action &, unsigned long) { ++fired; }
+
+static NexaCommand command(unsigned long id, byte channel, bool state)
+{
+	NexaCommand cmd;
+	NexaCommand::from_packed(cmd, PackedCommand::make(
+		NexaCommand::NEXA_32BIT, id, false, channel, state));
+	return cmd;
+}
+
+static bool define(RuleTable & rules, const char * def)
+{
+	return rules.define(def, strlen(def));
+}
+
+static void test_cooldown()
+{
+	RuleTable rules(fire);
+	CHECK(define(rules, "2:100000:0:*:1>2:200000:0:1:1,0,5000"));
+	fired = 0;
+
+	unsigned long now = 1000;
+	CHECK(rules.on_command(command(0x100000, 3, true), now, 0) == 1);
+	CHECK(fired == 1);
+	CHECK(rules.on_command(command(0x100000, 4, true), now + 4999, 0));
+	CHECK(fired == 1); // cooling down
+	CHECK(!rules.on_command(command(0x100000, 3, false), now + 5000, 0));
+	rules.on_command(command(0x100000, 3, true), now + 5000, 0);
+	CHECK(fired == 2);
+}
+
+static void test_delayed()
+{
+	RuleTable rules(fire);
+	CHECK(define(rules, "2:100000:0:1:1>@scene0,2000"));
+	fired = 0;
+
+	rules.on_command(command(0x100000, 1, true), 0, 0);
+	CHECK(!fired);
+	CHECK(define(rules, "2:100000:0:1:1>")); // remove the rule
+	rules.tick(1999);
+	CHECK(!fired);
+	rules.tick(2000);
+	CHECK(fired == 1);
+}
+
+static void test_full_pending()
+{
+	RuleTable rules(fire);
+	char def[64];
+	for (size_t i = 0; i <= RuleTable::max_pending; ++i) {
+		snprintf(def, sizeof(def), "2:%06X:0:1:1>2:200000:0:1:1,1000",
+			 unsigned(0x100000 + i));
+		CHECK(define(rules, def));
+	}
+	fired = 0;
+
+	// One more delayed action than can wait
+	for (size_t i = 0; i <= RuleTable::max_pending; ++i)
+		rules.on_command(command(0x100000 + i, 1, true), 0, 0);
+	CHECK(rules.dropped() == 1);
+	rules.tick(1000);
+	CHECK(fired == RuleTable::max_pending);
+
+	// The dropped rule was not marked as fired, so it is not cooling down
+	unsigned long last = 0x100000 + RuleTable::max_pending;
+	rules.on_command(command(last, 1, true), 1000, 0);
+	CHECK(rules.dropped() == 1);
+	rules.tick(2000);
+	CHECK(fired == RuleTable::max_pending + 1);
+	rules.print(Serial);
+}
+
+static void test_invalid()
+{
+	RuleTable rules(fire);
+	CHECK(!define(rules, "2:100000:0:1:1>2:200000:0:1:1,"));
+	CHECK(!define(rules, "2:100000:0:1:1>2:200000:0:1:1,-5"));
+	CHECK(!define(rules, "2:100000:0:1:1>2:200000:0:1:1,10x"));
+	CHECK(!define(rules, "2:100000:0:1:1>2:200000:0:1:1,0,2147483648"));
+	CHECK(!define(rules, "2:100000:0:1:1>2:200000:0:1:1,99999999999"));
+	CHECK(define(rules, "2:100000:0:1:1>2:200000:0:1:1,2147483647,0"));
+	CHECK(rules.size() == 1);
+}
+
+int main()
+{
+	test_cooldown();
+	test_delayed();
+	test_full_pending();
+	test_invalid();
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Host test for the task scheduler (Scheduler.h).
+ *
+ * The scheduler is driven by a simulated µs clock, with the same tasks,
+ * budgets, periods and latencies as main.ino. Each task advances the
+ * clock by a simulated run time when it is called. Two loads are run:
+ *
+ *  - light: all tasks fit in a round. No deadline may be missed, and
+ *    periodic tasks must run once per period.
+ *
+ *  - overload: rx and decode use up the round budget in every round.
+ *    Every task must still run, and no task may wait longer than its
+ *    deadline (see Scheduler::deadline()) plus one round after it became
+ *    due - including tx and cloud, which have no explicit max latency.
+ *
+ * Build and run (from the top of the repository):
+ *
+ *     g++ -std=c++11 -O2 -I. -Itools/host -o scheduler_test \
+ *         tools/scheduler_test.cpp && ./scheduler_test
+ *
+ * Exits with status 1 if any test fails.
+ */
+
+#include "spark_host.h"
+#include "Scheduler.h"
+
+static int failures = 0;
+
+#define CHECK(expr) do { \
+	if (!(expr)) { \
+		printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+		++failures; \
+	} \
+} while (0)
+
+static const unsigned long round_budget = 10000; // as in main.ino
+static const unsigned long loop_overhead = 50; // µs between rounds
+
+static unsigned long now_us;
+static unsigned long sim_clock() { return now_us; }
+
+struct Sim {
+	const char * name;
+	byte priority;
+	unsigned long budget, period, max_latency;
+	unsigned long cost; // simulated run time (µs)
+
+	unsigned long last_run; // µs
+	unsigned long max_gap; // µs between two runs
+	unsigned long runs;
+};
+
+// As added in setup() in main.ino; cost and statistics are set by run()
+static Sim sims[] = {
+	{ "rx", 0, 2000, 0, 0, 0, 0, 0, 0 },
+	{ "decode", 1, 2000, 0, 50000, 0, 0, 0, 0 },
+	{ "rules", 2, 1000, 10000, 50000, 0, 0, 0, 0 },
+	{ "tx", 2, 500000, 0, 0, 0, 0, 0, 0 },
+	{ "serial", 3, 2000, 10000, 100000, 0, 0, 0, 0 },
+	{ "cloud", 4, 5000, 0, 0, 0, 0, 0, 0 },
+	{ "housekeeping", 5, 20000, 100000, 1000000, 0, 0, 0, 0 }, // stats_period
+	{ "persist", 5, 50000, 100000, 1000000, 0, 0, 0, 0 }, // persist_period
+};
+static const size_t num_sims = ARRAY_LENGTH(sims);
+
+static void run_sim(size_t i)
+{
+	Sim & s = sims[i];
+	if (s.runs && now_us - s.last_run > s.max_gap)
+		s.max_gap = now_us - s.last_run;
+	s.last_run = now_us;
+	++s.runs;
+	now_us += s.cost;
+}
+
+// One TaskFunc per task, since tasks get no argument
+template<size_t I> void task() { run_sim(I); }
+static const Scheduler::TaskFunc funcs[] = {
+	task<0>, task<1>, task<2>, task<3>,
+	task<4>, task<5>, task<6>, task<7>,
+};
+
+/*
+ * Run the scheduler for the given time (µs), with the given run time
+ * of each task (µs). Check and print the results.
+ */
+static void run(const char * name, const unsigned long * costs,
+		unsigned long duration, bool overload)
+{
+	now_us = 1000; // not 0, to catch wraparound confusion
+	Scheduler scheduler(sim_clock, round_budget);
+	unsigned long round_max = 0;
+	for (size_t i = 0; i < num_sims; ++i) {
+		Sim & s = sims[i];
+		s.cost = costs[i];
+		s.runs = s.max_gap = s.last_run = 0;
+		round_max += s.cost;
+		CHECK(scheduler.add(s.name, funcs[i], s.priority, s.budget,
+				    s.period, s.max_latency));
+	}
+	round_max += loop_overhead;
+
+	unsigned long start = now_us;
+	while (now_us - start < duration) {
+		scheduler.run();
+		now_us += loop_overhead;
+	}
+
+	printf("%s: %lu rounds\n", name, scheduler.rounds());
+	for (size_t i = 0; i < scheduler.size(); ++i) {
+		const Scheduler::Task & t = scheduler[i];
+		const Sim * s = sims;
+		while (strcmp(s->name, t.name))
+			++s;
+		unsigned long deadline = t.max_latency ? t.max_latency :
+			t.period ? t.period : round_budget;
+		printf("  %-12s runs = %7lu, misses = %6lu, max gap = %8lu us\n",
+		       t.name, t.runs, t.misses, s->max_gap);
+
+		CHECK(t.runs == s->runs);
+		if (t.period < duration)
+			CHECK(s->runs > 1);
+		if (!overload) {
+			CHECK(!t.misses);
+			if (t.period && t.period < duration)
+				CHECK(t.runs >= duration / t.period);
+		}
+		// Waited at most deadline + a round after becoming due
+		CHECK(s->max_gap <= t.period + deadline + round_max);
+	}
+}
+
+int main()
+{
+	// rx, decode, rules, tx, serial, cloud, housekeeping, persist
+	const unsigned long light[] = {
+		200, 300, 100, 50, 200, 500, 5000, 3000,
+	};
+	const unsigned long overload[] = {
+		4000, 9000, 800, 3000, 1500, 4000, 15000, 20000,
+	};
+	run("light load", light, 120000000, false);
+	run("overload", overload, 120000000, true);
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * Host tests for the persistent store (LogStore and StateStore).
+ *
+ * Runs on a RamMedium (see tools/host/ram_medium.h):
+ *
+ *  - crash consistency: a random sequence of puts and removes is cut
+ *    short by a simulated power loss after every possible byte. After
+ *    each crash, a freshly mounted store must hold exactly the values
+ *    from before or after the interrupted put, and must keep working.
+ *
+ *  - a fully configured node (all devices, scenes and rules) on the
+ *    2047 bytes of emulated EEPROM, in the segments used by main.ino:
+ *    every sync step must write a bounded number of records and compact
+ *    at most once, nothing may be left unsaved, and all state must be
+ *    restored after a reboot.
+ *
+ *  - the same configuration on a 100-byte medium (as on the Spark
+ *    Core): nothing may be refused, and what does not fit must be
+ *    reported as unsaved, never silently lost.
+ *
+ * Build and run (from the top of the repository):
+ *
+ *     g++ -std=c++11 -O2 -I. -Itools/host -o store_test \
+ *         tools/store_test.cpp && ./store_test
+ *
+ * Exits with status 1 if any test fails.
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "spark_host.h"
+#include "NexaCommand.h"
+#include "FrameCache.h"
+#include "SceneTable.h"
+#include "DeviceRegistry.h"
+#include "RuleTable.h"
+#include "LogStore.h"
+#include "StateStore.h"
+#include "ram_medium.h"
+
+typedef std::map<uint32_t, std::vector<byte> > Contents;
+typedef SceneTable<FrameCache<8> > Scenes;
+
+static int failures = 0;
+
+#define CHECK(expr) do { \
+	if (!(expr)) { \
+		printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+		++failures; \
+	} \
+} while (0)
+
+struct Op {
+	uint32_t key;
+	std::vector<byte> value; // empty == remove
+};
+
+static Contents contents(const LogStore & store)
+{
+	Contents c;
+	for (size_t i = 0; i < store.size(); ++i) {
+		byte buf[LogStore::max_value];
+		uint32_t k = store.key_at(i);
+		size_t len = store.get(k, buf, sizeof(buf));
+		c[k] = std::vector<byte>(buf, buf + len);
+	}
+	return c;
+}
+
+static bool apply(LogStore & store, Contents & c, const Op & op)
+{
+	if (!store.put(op.key, op.value.data(), op.value.size()))
+		return false;
+	if (op.value.empty())
+		c.erase(op.key);
+	else
+		c[op.key] = op.value;
+	return true;
+}
+
+static void test_crashes()
+{
+	const size_t size = 1024, segments = 2;
+	srand(1);
+	std::vector<Op> ops(400);
+	for (size_t i = 0; i < ops.size(); ++i) {
+		ops[i].key = rand() % 12;
+		size_t len = rand() % 5 ? 1 + rand() % 20 : 0;
+		for (size_t j = 0; j < len; ++j)
+			ops[i].value.push_back(rand());
+	}
+
+	// Count the bytes written by an uninterrupted run
+	RamMedium clean(size);
+	LogStore ref(clean, segments);
+	ref.mount();
+	Contents expected;
+	for (size_t i = 0; i < ops.size(); ++i)
+		CHECK(apply(ref, expected, ops[i]));
+	unsigned long total = 0;
+	for (size_t a = 0; a < size; ++a)
+		total += clean.writes(a);
+
+	unsigned long bad = 0;
+	for (unsigned long n = 0; n < total; ++n) {
+		RamMedium medium(size);
+		LogStore store(medium, segments);
+		store.mount();
+		medium.crash_after(n, n & 1 ? 0x00 : byte(n * 37));
+		Contents before, after;
+		size_t i = 0;
+		for (; i < ops.size(); ++i) {
+			before = after;
+			apply(store, after, ops[i]);
+			if (medium.crashed())
+				break;
+		}
+		medium.power_on();
+
+		LogStore rebooted(medium, segments);
+		rebooted.mount();
+		Contents c = contents(rebooted);
+		bool ok = c == before || c == after;
+		for (size_t j = 0; j < 50; ++j) // keeps working
+			ok &= apply(rebooted, c, ops[(i + j) % ops.size()]);
+		LogStore again(medium, segments);
+		again.mount();
+		ok &= contents(again) == c;
+		if (!ok && bad++ < 5)
+			printf("crash after %lu bytes: bad contents\n", n);
+	}
+	CHECK(bad == 0);
+	printf("crash consistency: %lu crash points, %lu bad\n", total, bad);
+}
+
+static void fire(const RuleTable::Action &, unsigned long) { }
+
+static NexaCommand command(unsigned long id, byte channel, bool state)
+{
+	NexaCommand cmd;
+	NexaCommand::from_packed(cmd, PackedCommand::make(
+		NexaCommand::NEXA_32BIT, id, false, channel, state));
+	return cmd;
+}
+
+// Configure the given tables to the max; return # of refused items
+static size_t configure(DeviceRegistry & registry, Scenes & scenes,
+			RuleTable & rules, StateStore<Scenes> & state)
+{
+	size_t refused = 0;
+	for (size_t i = 0; i < DeviceRegistry::max_devices; ++i) {
+		registry.learn(command(0x100000 + i, i % 16, i & 1));
+		if (i % 2)
+			registry.pair(0x100000 + i, 0x0003 << (i % 16) / 2);
+	}
+	for (size_t i = 0; i < Scenes::max_scenes; ++i) {
+		NexaCommand cmds[Scenes::max_cmds];
+		for (size_t j = 0; j < Scenes::max_cmds; ++j)
+			cmds[j] = command(0x200000 + j, j, i & 1);
+		char name[] = "sceneN";
+		name[5] = '0' + i;
+		if (!scenes.define(name, strlen(name), cmds, Scenes::max_cmds))
+			++refused;
+	}
+	for (size_t i = 0; i < RuleTable::max_rules; ++i) {
+		char def[64];
+		snprintf(def, sizeof(def), "2:%06X:0:*:1>%s,%u,%u",
+			 unsigned(0x300000 + i), i & 1 ? "@scene0" :
+			 "2:123456:0:1:1", unsigned(i * 1000), 60000U);
+		if (!rules.define(def, strlen(def)))
+			++refused;
+	}
+	state.touch();
+	return refused;
+}
+
+static std::string describe(const DeviceRegistry & registry,
+			    const Scenes & scenes, const RuleTable & rules)
+{
+	StringPrint out;
+	registry.print(out);
+	for (size_t i = 0; i < Scenes::max_scenes; ++i) {
+		const Scenes::Scene & s = scenes.slot(i);
+		out.print(s.name);
+		for (size_t j = 0; j < s.num_cmds; ++j)
+			s.cmds[j].print(out);
+	}
+	for (size_t i = 0; i < rules.size(); ++i) {
+		byte buf[RuleTable::saved_size];
+		rules.save(i, buf);
+		out.write(buf, sizeof(buf));
+	}
+	return out.str;
+}
+
+/*
+ * Run sync passes until the state is clean, checking that each step
+ * compacts at most once. Return the number of steps.
+ */
+static size_t sync_all(StateStore<Scenes> & state, LogStore & store)
+{
+	size_t steps = 0;
+	while (state.dirty() || state.syncing()) {
+		unsigned long compactions = store.compactions();
+		state.sync(2);
+		CHECK(store.compactions() - compactions <= 1);
+		++steps;
+	}
+	return steps;
+}
+
+static void test_full_node(size_t size, const char * name)
+{
+	const size_t segments = 2; // as in main.ino
+	RamMedium medium(size);
+	std::string expected;
+	size_t refused, unsaved;
+	{
+		FrameCache<8> cache;
+		Scenes scenes(cache);
+		DeviceRegistry registry;
+		RuleTable rules(fire);
+		LogStore store(medium, segments);
+		StateStore<Scenes> state(store, registry, scenes, rules);
+		state.restore();
+		refused = configure(registry, scenes, rules, state);
+		state.on_receive(command(0x100003, 3, true).pack());
+		size_t steps = sync_all(state, store);
+
+		// Churn device states, to force compactions
+		for (size_t i = 0; i < 200; ++i) {
+			registry.learn(command(0x100000 + i % 4, i % 4, i / 4 & 1));
+			state.touch();
+			steps += sync_all(state, store);
+		}
+		expected = describe(registry, scenes, rules);
+		unsaved = state.unsaved();
+		printf("%s: %zu refused, %zu unsaved, %zu steps, max %lu writes "
+		       "per byte\n", name, refused, unsaved, steps,
+		       medium.max_writes());
+		state.print(Serial);
+		store.print(Serial);
+		CHECK(!refused);
+		// Every item is either saved, or counted as unsaved
+		CHECK(store.size() - 1 + unsaved == registry.size() +
+		      scenes.size() + rules.size());
+		if (size >= 2047)
+			CHECK(!unsaved);
+	}
+
+	FrameCache<8> cache;
+	Scenes scenes(cache);
+	DeviceRegistry registry;
+	RuleTable rules(fire);
+	LogStore store(medium, segments);
+	StateStore<Scenes> state(store, registry, scenes, rules);
+	unsigned long start = micros();
+	PackedCommand last = state.restore();
+	printf("%s: restored in %lu us\n", name, micros() - start);
+	CHECK(last == command(0x100003, 3, true).pack());
+	if (!unsaved)
+		CHECK(describe(registry, scenes, rules) == expected);
+}
+
+int main()
+{
+	test_crashes();
+	test_full_node(2047, "2047-byte EEPROM");
+	test_full_node(100, "100-byte EEPROM");
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures ? 1 : 0;
+}